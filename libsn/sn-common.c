@@ -27,27 +27,56 @@
 #include "sn-common.h"
 #include "sn-internals.h"
 
+#include <stddef.h>
+
 #include <xcb/xcb.h>
 #include <xcb/xcb_aux.h>
 #include <xcb/xcb_event.h>
 
 #include <X11/Xlib-xcb.h>
 
+/* An atom whose InternAtom reply may not have been read yet */
+struct SnLazyAtom
+{
+  char *name;
+  sn_bool_t resolved;
+  xcb_atom_t atom;
+  xcb_intern_atom_cookie_t cookie;
+};
+
+/* A string shared by everything on a display that needs the same value */
+typedef struct
+{
+  int refcount;
+  unsigned int hash;
+  char str[1];
+} SnPooledString;
+
+#define POOLED_STRING(str) \
+  ((SnPooledString*) ((str) - offsetof (SnPooledString, str)))
+
 struct SnDisplay
 {
   int refcount;
   Display *xdisplay;
   xcb_connection_t *xconnection;
   xcb_screen_t **screens;
-  xcb_atom_t UTF8_STRING, NET_STARTUP_ID,
-    NET_STARTUP_INFO, NET_STARTUP_INFO_BEGIN;
+  /* Every atom interned through this display, by name */
+  SnHash *atoms;
+  SnLazyAtom *UTF8_STRING, *NET_STARTUP_ID,
+    *NET_STARTUP_INFO, *NET_STARTUP_INFO_BEGIN, *WM_CLIENT_LEADER;
+  /* Pooled strings, by value */
+  SnHash *strings;
+  int n_string_hits;
+  int n_string_misses;
+  int string_bytes_saved;
   SnDisplayErrorTrapPush push_trap_func;
   SnDisplayErrorTrapPop  pop_trap_func;
   SnXcbDisplayErrorTrapPush xcb_push_trap_func;
   SnXcbDisplayErrorTrapPop  xcb_pop_trap_func;
   int n_screens;
-  SnList *xmessage_funcs;
-  SnList *pending_messages;
+  SnXmessageData *xmessage_data;
+  SnMonitorData *monitor_data;
 };
 
 /**
@@ -110,24 +139,6 @@ sn_xcb_display_new (xcb_connection_t          *xconnection,
   SnDisplay *display;
   int i;
 
-  /* Get all atoms we will need in the future */
-  xcb_intern_atom_cookie_t atom_utf8_string_c =
-    xcb_intern_atom(xconnection, FALSE,
-                    sizeof("UTF8_STRING") - 1, "UTF8_STRING");
-
-  xcb_intern_atom_cookie_t atom_net_startup_info_begin_c =
-    xcb_intern_atom(xconnection, FALSE,
-                    sizeof("_NET_STARTUP_INFO_BEGIN") - 1,
-                    "_NET_STARTUP_INFO_BEGIN");
-
-  xcb_intern_atom_cookie_t atom_net_startup_info_c =
-    xcb_intern_atom(xconnection, FALSE,
-                    sizeof("_NET_STARTUP_INFO") - 1, "_NET_STARTUP_INFO");
-
-  xcb_intern_atom_cookie_t atom_net_startup_id_c =
-    xcb_intern_atom(xconnection, FALSE,
-                    sizeof("_NET_STARTUP_ID") - 1, "_NET_STARTUP_ID");
-
   display = sn_new0 (SnDisplay, 1);
 
   display->xconnection = xconnection;
@@ -141,31 +152,22 @@ sn_xcb_display_new (xcb_connection_t          *xconnection,
   for (i = 0; i < display->n_screens; ++i)
     display->screens[i] = xcb_aux_get_screen(xconnection, i);
 
-  xcb_intern_atom_reply_t *atom_reply;
+  /* Ask for all atoms we will need in the future, but don't
+   * wait for the replies until one of them is used
+   */
+  display->atoms = sn_hash_new (sn_string_hash, sn_string_equal);
+  display->UTF8_STRING =
+    sn_internal_display_intern_atom (display, "UTF8_STRING");
+  display->NET_STARTUP_INFO_BEGIN =
+    sn_internal_display_intern_atom (display, "_NET_STARTUP_INFO_BEGIN");
+  display->NET_STARTUP_INFO =
+    sn_internal_display_intern_atom (display, "_NET_STARTUP_INFO");
+  display->NET_STARTUP_ID =
+    sn_internal_display_intern_atom (display, "_NET_STARTUP_ID");
+  display->WM_CLIENT_LEADER =
+    sn_internal_display_intern_atom (display, "WM_CLIENT_LEADER");
 
-  atom_reply = xcb_intern_atom_reply(display->xconnection,
-                                     atom_utf8_string_c,
-                                     NULL);
-  display->UTF8_STRING = atom_reply->atom;
-  free(atom_reply);
-
-  atom_reply = xcb_intern_atom_reply(display->xconnection,
-                                     atom_net_startup_info_begin_c,
-                                     NULL);
-  display->NET_STARTUP_INFO_BEGIN = atom_reply->atom;
-  free(atom_reply);
-
-  atom_reply = xcb_intern_atom_reply(display->xconnection,
-                                     atom_net_startup_info_c,
-                                     NULL);
-  display->NET_STARTUP_INFO = atom_reply->atom;
-  free(atom_reply);
-
-  atom_reply = xcb_intern_atom_reply(display->xconnection,
-                                     atom_net_startup_id_c,
-                                     NULL);
-  display->NET_STARTUP_ID = atom_reply->atom;
-  free(atom_reply);
+  display->strings = sn_hash_new (sn_string_hash, sn_string_equal);
 
   return display;
 }
@@ -182,12 +184,42 @@ sn_display_ref (SnDisplay *display)
   display->refcount += 1;
 }
 
+static sn_bool_t
+free_atom_foreach (void *key,
+                   void *value,
+                   void *data)
+{
+  SnLazyAtom *atom = value;
+
+  /* An unresolved atom's reply is left to the connection; the
+   * connection may already be gone by the time the display is freed
+   */
+  sn_free (atom->name);
+  sn_free (atom);
+
+  return TRUE;
+}
+
+static sn_bool_t
+free_string_foreach (void *key,
+                     void *value,
+                     void *data)
+{
+  sn_free (value);
+
+  return TRUE;
+}
+
 /**
  * sn_display_unref:
  * @display: an #SnDisplay
  * 
  * Decrement the reference count for @display, freeing
  * display if the reference count reaches zero.
+ *
+ * Freeing the display only sends requests if message windows
+ * are still cached by sn_display_set_reuse_message_windows();
+ * in that case the X connection must still be open.
  **/
 void
 sn_display_unref (SnDisplay *display)
@@ -195,10 +227,17 @@ sn_display_unref (SnDisplay *display)
   display->refcount -= 1;
   if (display->refcount == 0)
     {
-      if (display->xmessage_funcs)
-        sn_list_free (display->xmessage_funcs);
-      if (display->pending_messages)
-        sn_list_free (display->pending_messages);
+      if (display->xmessage_data)
+        {
+          sn_internal_xmessage_release_windows (display);
+          sn_internal_xmessage_data_free (display->xmessage_data);
+        }
+      if (display->monitor_data)
+        sn_internal_monitor_data_free (display->monitor_data);
+      sn_hash_foreach (display->atoms, free_atom_foreach, NULL);
+      sn_hash_free (display->atoms);
+      sn_hash_foreach (display->strings, free_string_foreach, NULL);
+      sn_hash_free (display->strings);
       sn_free (display->screens);
       sn_free (display);
     }
@@ -392,6 +431,110 @@ sn_xcb_display_process_event (SnDisplay           *display,
   return retval;
 }
 
+/**
+ * sn_xcb_display_process_events:
+ * @display: a display
+ * @events: events to process
+ * @n_events: number of events
+ * @handled_mask: bit mask of @n_events bits, bit i of byte i / 8
+ * being set if event i was handled, or %NULL
+ *
+ * Processes a batch of events, such as those an application drained
+ * from its event queue, with the same effect as calling
+ * sn_xcb_display_process_event() on each in turn. Events other than
+ * ClientMessages are skipped right away, and the messages completed
+ * by the batch are dispatched together at the end.
+ *
+ * Return value: the number of events handled
+ **/
+int
+sn_xcb_display_process_events (SnDisplay            *display,
+                               xcb_generic_event_t **events,
+                               int                   n_events,
+                               unsigned char        *handled_mask)
+{
+  if (n_events <= 0)
+    return 0;
+
+  sn_internal_monitor_process_event (display);
+
+  return sn_internal_xmessage_process_events (display, events, n_events,
+                                              handled_mask);
+}
+
+/**
+ * sn_display_get_interesting_atoms:
+ * @display: a display
+ * @n_atoms: return location for the number of atoms
+ * @serial: return location for the serial of the set, or %NULL
+ *
+ * Gets the ClientMessage types the handlers on @display are
+ * listening for, so an application can drop other events without
+ * calling into the library, or select only what it needs. This may
+ * wait for the X server to resolve the atoms of new handlers, so
+ * call it when setting up rather than per event.
+ *
+ * The array belongs to @display and stays valid until the next call.
+ * It goes stale when the handlers change, for example when the first
+ * monitor context is created or the last one destroyed; compare
+ * @serial with sn_display_get_interesting_atoms_serial() to find out.
+ *
+ * Return value: array of @n_atoms atoms
+ **/
+const xcb_atom_t*
+sn_display_get_interesting_atoms (SnDisplay    *display,
+                                  int          *n_atoms,
+                                  unsigned int *serial)
+{
+  return sn_internal_xmessage_get_interesting_atoms (display, n_atoms,
+                                                     serial);
+}
+
+/**
+ * sn_display_get_interesting_atoms_serial:
+ * @display: a display
+ *
+ * Gets a number that changes whenever the atoms
+ * sn_display_get_interesting_atoms() returns may have changed.
+ * Doesn't talk to the X server.
+ *
+ * Return value: the serial
+ **/
+unsigned int
+sn_display_get_interesting_atoms_serial (SnDisplay *display)
+{
+  return sn_internal_xmessage_get_interesting_atoms_serial (display);
+}
+
+/**
+ * sn_xcb_display_event_is_interesting:
+ * @display: a display
+ * @xevent: an event
+ *
+ * Checks whether sn_xcb_display_process_event() could do anything
+ * with @xevent, without processing it or waiting for the X server.
+ * The answer reflects the handlers installed at the time of the
+ * call. The atoms of new handlers are only resolved when the next
+ * ClientMessage is processed or sn_display_get_interesting_atoms() is
+ * called; until then every ClientMessage counts as interesting.
+ *
+ * Return value: %TRUE if @xevent is a ClientMessage a handler wants
+ **/
+sn_bool_t
+sn_xcb_display_event_is_interesting (SnDisplay           *display,
+                                     xcb_generic_event_t *xevent)
+{
+  xcb_client_message_event_t *ev;
+
+  if (XCB_EVENT_RESPONSE_TYPE (xevent) != XCB_CLIENT_MESSAGE)
+    return FALSE;
+
+  ev = (xcb_client_message_event_t *) xevent;
+
+  return sn_internal_xmessage_event_is_interesting (display, ev->window,
+                                                    ev->type);
+}
+
 /**
  * sn_display_error_trap_push:
  * @display: a display
@@ -436,43 +579,482 @@ sn_display_error_trap_pop  (SnDisplay *display)
   }
 }
 
+/**
+ * sn_display_set_pending_message_limits:
+ * @display: a display
+ * @max_messages: maximum number of partially received X messages, or 0
+ * @max_age: milliseconds a partially received X message may stay
+ * pending, or 0
+ *
+ * X messages arrive in 20-byte pieces and are reassembled per
+ * identifying window. If the sender dies in the middle of a message
+ * the rest never arrives; these limits bound how many such partial
+ * messages are kept and for how long. The oldest partial messages are
+ * discarded when a new message starts arriving, and, once too old,
+ * by sn_display_dispatch_timeouts(). A limit of 0 disables that
+ * limit.
+ **/
+void
+sn_display_set_pending_message_limits (SnDisplay *display,
+                                       int        max_messages,
+                                       int        max_age)
+{
+  sn_internal_xmessage_set_pending_limits (sn_internal_display_get_xmessage_data (display),
+                                           max_messages, max_age);
+}
+
+/**
+ * sn_display_get_pending_message_stats:
+ * @display: a display
+ * @n_pending: return location for the number of partial messages
+ * @n_evicted: return location for the number of partial messages
+ * discarded because there were too many
+ * @n_expired: return location for the number of partial messages
+ * discarded because they were too old
+ * @n_discarded: return location for the number of messages discarded
+ * because they were too long
+ *
+ * Gets counters describing X message reassembly on @display.
+ * Any of the return locations may be %NULL.
+ **/
+void
+sn_display_get_pending_message_stats (SnDisplay *display,
+                                      int       *n_pending,
+                                      int       *n_evicted,
+                                      int       *n_expired,
+                                      int       *n_discarded)
+{
+  sn_internal_xmessage_get_pending_stats (sn_internal_display_get_xmessage_data (display),
+                                          n_pending, n_evicted,
+                                          n_expired, n_discarded);
+}
+
+/**
+ * sn_display_set_reuse_message_windows:
+ * @display: a display
+ * @reuse: whether to reuse identifier windows
+ *
+ * Every X message sent is identified by a window. By default a new
+ * window is created and destroyed for each message, which every
+ * client watching the root window for substructure changes hears
+ * about. If @reuse is %TRUE, one window per screen is created the
+ * first time it is needed and used for all later messages, until
+ * reuse is turned off again or @display is freed.
+ **/
 void
-sn_internal_display_get_xmessage_data (SnDisplay              *display,
-                                       SnList                **funcs,
-                                       SnList                **pending)
+sn_display_set_reuse_message_windows (SnDisplay *display,
+                                      sn_bool_t  reuse)
 {
-  if (display->xmessage_funcs == NULL)
-    display->xmessage_funcs = sn_list_new ();
+  sn_internal_xmessage_set_reuse_windows (display, reuse);
+}
 
-  if (display->pending_messages == NULL)
-    display->pending_messages = sn_list_new ();
-  
-  if (funcs)
-    *funcs = display->xmessage_funcs;
-  if (pending)
-    *pending = display->pending_messages;
+/**
+ * sn_display_begin_batch:
+ * @display: a display
+ *
+ * Starts a batch of X messages. Until the matching
+ * sn_display_end_batch(), messages sent on @display by launcher
+ * and launchee contexts and by sn_startup_sequence_complete() are
+ * not flushed to the X server, and share one identifying window
+ * per screen. Batches may be nested; the messages are flushed when
+ * the outermost batch ends.
+ **/
+void
+sn_display_begin_batch (SnDisplay *display)
+{
+  sn_internal_xmessage_begin_batch (display);
+}
+
+/**
+ * sn_display_end_batch:
+ * @display: a display
+ *
+ * Ends a batch started with sn_display_begin_batch(), flushing the
+ * messages sent during it if this was the outermost batch.
+ **/
+void
+sn_display_end_batch (SnDisplay *display)
+{
+  sn_internal_xmessage_end_batch (display);
+}
+
+/**
+ * sn_display_set_sequence_timeout:
+ * @display: a display
+ * @timeout: timeout in milliseconds, or 0 to never time out
+ *
+ * Sets how long a startup sequence seen by a monitor may go without
+ * completing before sn_display_dispatch_timeouts() cancels it. The
+ * default is 15 seconds.
+ **/
+void
+sn_display_set_sequence_timeout (SnDisplay *display,
+                                 int        timeout)
+{
+  sn_internal_monitor_set_sequence_timeout (display, timeout);
+}
+
+/**
+ * sn_display_set_early_change_limits:
+ * @display: a display
+ * @max_bytes: maximum memory used by early "change:" messages, or 0
+ * @max_age: milliseconds an early "change:" message is kept, or 0
+ *
+ * A "change:" message may arrive before the "new:" message for the
+ * same startup ID, in which case monitors keep it and apply it once
+ * the "new:" arrives. These limits bound how much is kept and for
+ * how long; the oldest messages are discarded first. The defaults
+ * are 16 KiB and one minute. A limit of 0 disables that limit.
+ * Expired messages are dropped by sn_display_dispatch_timeouts().
+ **/
+void
+sn_display_set_early_change_limits (SnDisplay *display,
+                                    int        max_bytes,
+                                    int        max_age)
+{
+  sn_internal_monitor_set_early_change_limits (display, max_bytes, max_age);
+}
+
+/**
+ * sn_display_set_defer_dispatch:
+ * @display: a display
+ * @defer: whether to queue monitor events instead of sending them
+ *
+ * When @defer is %TRUE, sn_display_process_event() and
+ * sn_xcb_display_process_event() only reassemble messages and update
+ * startup sequences; the resulting monitor events are queued, and
+ * monitor callbacks run from sn_display_dispatch_pending() instead.
+ * This keeps callbacks out of an application's X event handler.
+ * Sequences still end when their "remove:" message arrives, so
+ * lookups such as sn_monitor_find_sequence_by_wmclass() stop finding
+ * them before the COMPLETED event is sent.
+ * Turning deferral off sends the queued events.
+ **/
+void
+sn_display_set_defer_dispatch (SnDisplay *display,
+                               sn_bool_t  defer)
+{
+  sn_internal_monitor_set_defer_dispatch (display, defer);
+}
+
+/**
+ * sn_display_dispatch_pending:
+ * @display: a display
+ *
+ * Sends the monitor events queued since sn_display_set_defer_dispatch()
+ * was turned on, in order, followed by the changes held back by
+ * sn_display_set_coalesce_changes().
+ **/
+void
+sn_display_dispatch_pending (SnDisplay *display)
+{
+  sn_internal_monitor_dispatch_pending (display);
+}
+
+/**
+ * sn_display_has_pending:
+ * @display: a display
+ *
+ * Checks whether sn_display_dispatch_pending() has anything to do, so
+ * a main loop can install an idle handler only when needed.
+ *
+ * Return value: %TRUE if monitor events are queued or held back
+ **/
+sn_bool_t
+sn_display_has_pending (SnDisplay *display)
+{
+  return sn_internal_monitor_has_pending (display);
+}
+
+/**
+ * sn_display_set_coalesce_changes:
+ * @display: a display
+ * @coalesce: whether to hold back %SN_MONITOR_EVENT_CHANGED events
+ *
+ * Some launchers send a separate "change:" message for each field.
+ * When @coalesce is %TRUE, the %SN_MONITOR_EVENT_CHANGED events for a
+ * sequence are merged into one, carrying all the fields that changed,
+ * and held back until sn_display_flush_changes() is called, typically
+ * from an idle handler. Other events are still sent right away, after
+ * any held back change of the same sequence. Turning coalescing off
+ * flushes the held back events.
+ **/
+void
+sn_display_set_coalesce_changes (SnDisplay *display,
+                                 sn_bool_t  coalesce)
+{
+  sn_internal_monitor_set_coalesce_changes (display, coalesce);
+}
+
+/**
+ * sn_display_flush_changes:
+ * @display: a display
+ *
+ * Sends the %SN_MONITOR_EVENT_CHANGED events held back since
+ * sn_display_set_coalesce_changes() was turned on, one per sequence,
+ * in the order the sequences first changed. Events queued by
+ * sn_display_set_defer_dispatch() are older, so they are sent first.
+ **/
+void
+sn_display_flush_changes (SnDisplay *display)
+{
+  sn_internal_monitor_flush_changes (display);
+}
+
+/**
+ * sn_display_get_next_timeout:
+ * @display: a display
+ *
+ * Gets how long until the oldest startup sequence, partially
+ * received message or early "change:" message on @display times out,
+ * in milliseconds, as poll() and main loops take timeouts. The main loop should call
+ * sn_display_dispatch_timeouts() once that time has passed.
+ * Timeouts are measured on a monotonic clock where the system has
+ * one, so changing the system time doesn't affect them.
+ *
+ * Return value: the timeout, 0 if something has already timed out,
+ * or -1 if nothing is pending, so no wakeup is needed
+ **/
+int
+sn_display_get_next_timeout (SnDisplay *display)
+{
+  int timeout;
+  int message_timeout;
+
+  timeout = sn_internal_monitor_get_next_timeout (display);
+  message_timeout = sn_internal_xmessage_get_next_timeout (display);
+
+  if (timeout < 0 || (message_timeout >= 0 && message_timeout < timeout))
+    timeout = message_timeout;
+
+  return timeout;
+}
+
+/**
+ * sn_display_dispatch_timeouts:
+ * @display: a display
+ *
+ * Cancels every startup sequence on @display whose timeout has
+ * passed, sending %SN_MONITOR_EVENT_CANCELED to the monitor contexts
+ * and forgetting the sequence. Also drops partially received
+ * messages older than sn_display_set_pending_message_limits() allows
+ * and early "change:" messages older than
+ * sn_display_set_early_change_limits() allows.
+ **/
+void
+sn_display_dispatch_timeouts (SnDisplay *display)
+{
+  sn_internal_xmessage_dispatch_timeouts (display);
+  sn_internal_monitor_dispatch_timeouts (display);
+}
+
+SnXmessageData*
+sn_internal_display_get_xmessage_data (SnDisplay *display)
+{
+  if (display->xmessage_data == NULL)
+    display->xmessage_data = sn_internal_xmessage_data_new ();
+
+  return display->xmessage_data;
+}
+
+SnMonitorData*
+sn_internal_display_get_monitor_data (SnDisplay *display)
+{
+  if (display->monitor_data == NULL)
+    display->monitor_data = sn_internal_monitor_data_new ();
+
+  return display->monitor_data;
+}
+
+/**
+ * sn_internal_display_intern_atom:
+ * @display: an #SnDisplay
+ * @name: name of the atom
+ *
+ * Sends an InternAtom request for @name unless one has already been
+ * sent on @display, without waiting for the reply.
+ *
+ * Return value: the atom, to be passed to sn_internal_display_get_atom()
+ **/
+SnLazyAtom*
+sn_internal_display_intern_atom (SnDisplay  *display,
+                                 const char *name)
+{
+  SnLazyAtom *atom;
+
+  atom = sn_hash_lookup (display->atoms, name);
+  if (atom == NULL)
+    {
+      atom = sn_new0 (SnLazyAtom, 1);
+      atom->name = sn_internal_strdup (name);
+      atom->cookie = xcb_intern_atom (display->xconnection, FALSE,
+                                      strlen (name), name);
+      sn_hash_insert (display->atoms, atom->name, atom);
+    }
+
+  return atom;
+}
+
+/**
+ * sn_internal_display_get_atom:
+ * @display: an #SnDisplay
+ * @atom: an atom from sn_internal_display_intern_atom()
+ *
+ * Gets the X atom, reading the reply to the InternAtom request the
+ * first time.
+ *
+ * Return value: the atom, or %XCB_ATOM_NONE if it could not be interned
+ **/
+xcb_atom_t
+sn_internal_display_get_atom (SnDisplay  *display,
+                              SnLazyAtom *atom)
+{
+  xcb_intern_atom_reply_t *reply;
+
+  if (atom->resolved)
+    return atom->atom;
+
+  reply = xcb_intern_atom_reply (display->xconnection, atom->cookie, NULL);
+  atom->atom = reply ? reply->atom : XCB_ATOM_NONE;
+  atom->resolved = TRUE;
+  free (reply);
+
+  return atom->atom;
+}
+
+/**
+ * sn_internal_display_intern_string:
+ * @display: an #SnDisplay
+ * @str: a string
+ *
+ * Gets the copy of @str shared by everything on @display that
+ * interned the same value, adding a reference to it. Two interned
+ * strings are equal exactly when they are the same pointer.
+ *
+ * Return value: the shared copy, to be released with
+ * sn_internal_display_release_string()
+ **/
+const char*
+sn_internal_display_intern_string (SnDisplay  *display,
+                                   const char *str)
+{
+  SnPooledString *pooled;
+  unsigned int hash;
+  int len;
+
+  hash = sn_string_hash (str);
+  pooled = sn_hash_lookup_hashed (display->strings, str, hash);
+  len = strlen (str);
+
+  if (pooled)
+    {
+      pooled->refcount += 1;
+      display->n_string_hits += 1;
+      display->string_bytes_saved += len + 1;
+    }
+  else
+    {
+      pooled = sn_malloc (sizeof (SnPooledString) + len);
+      pooled->refcount = 1;
+      pooled->hash = hash;
+      memcpy (pooled->str, str, len + 1);
+      sn_hash_insert_hashed (display->strings, pooled->str, hash, pooled);
+      display->n_string_misses += 1;
+    }
+
+  return pooled->str;
+}
+
+/**
+ * sn_internal_display_release_string:
+ * @display: an #SnDisplay
+ * @str: a string from sn_internal_display_intern_string(), or %NULL
+ *
+ * Drops a reference to an interned string, freeing it once the last
+ * one is gone.
+ **/
+void
+sn_internal_display_release_string (SnDisplay  *display,
+                                    const char *str)
+{
+  SnPooledString *pooled;
+
+  if (str == NULL)
+    return;
+
+  pooled = POOLED_STRING (str);
+  pooled->refcount -= 1;
+
+  if (pooled->refcount > 0)
+    {
+      display->string_bytes_saved -= strlen (str) + 1;
+    }
+  else
+    {
+      sn_hash_remove_hashed (display->strings, pooled->str, pooled->hash);
+      sn_free (pooled);
+    }
+}
+
+/**
+ * sn_display_get_string_pool_stats:
+ * @display: a display
+ * @n_strings: return location for the number of distinct strings
+ * @n_hits: return location for the number of times a string was
+ * already in the pool
+ * @n_misses: return location for the number of times a string had
+ * to be added to the pool
+ * @bytes_saved: return location for the bytes currently saved by
+ * sharing strings
+ *
+ * Gets counters describing the pool @display keeps of the attribute
+ * strings of startup sequences, such as names and WM classes, so
+ * sequences with equal values share one copy. Any of the return
+ * locations may be %NULL.
+ **/
+void
+sn_display_get_string_pool_stats (SnDisplay *display,
+                                  int       *n_strings,
+                                  int       *n_hits,
+                                  int       *n_misses,
+                                  int       *bytes_saved)
+{
+  if (n_strings)
+    *n_strings = sn_hash_size (display->strings);
+  if (n_hits)
+    *n_hits = display->n_string_hits;
+  if (n_misses)
+    *n_misses = display->n_string_misses;
+  if (bytes_saved)
+    *bytes_saved = display->string_bytes_saved;
 }
 
 xcb_atom_t
 sn_internal_get_utf8_string_atom(SnDisplay *display)
 {
-  return display->UTF8_STRING;
+  return sn_internal_display_get_atom (display, display->UTF8_STRING);
 }
 
 xcb_atom_t
 sn_internal_get_net_startup_id_atom(SnDisplay *display)
 {
-  return display->NET_STARTUP_ID;
+  return sn_internal_display_get_atom (display, display->NET_STARTUP_ID);
+}
+
+xcb_atom_t
+sn_internal_get_wm_client_leader_atom(SnDisplay *display)
+{
+  return sn_internal_display_get_atom (display, display->WM_CLIENT_LEADER);
 }
 
 xcb_atom_t
 sn_internal_get_net_startup_info_atom(SnDisplay *display)
 {
-  return display->NET_STARTUP_INFO;
+  return sn_internal_display_get_atom (display, display->NET_STARTUP_INFO);
 }
 
 xcb_atom_t
 sn_internal_get_net_startup_info_begin_atom(SnDisplay *display)
 {
-  return display->NET_STARTUP_INFO_BEGIN;
+  return sn_internal_display_get_atom (display, display->NET_STARTUP_INFO_BEGIN);
 }
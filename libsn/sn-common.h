@@ -65,10 +65,53 @@ sn_bool_t  sn_display_process_event   (SnDisplay              *display,
                                        XEvent                 *xevent);
 sn_bool_t  sn_xcb_display_process_event (SnDisplay              *display,
                                          xcb_generic_event_t    *xevent);
+int        sn_xcb_display_process_events (SnDisplay            *display,
+                                          xcb_generic_event_t **events,
+                                          int                   n_events,
+                                          unsigned char        *handled_mask);
+
+const xcb_atom_t* sn_display_get_interesting_atoms        (SnDisplay           *display,
+                                                           int                 *n_atoms,
+                                                           unsigned int        *serial);
+unsigned int      sn_display_get_interesting_atoms_serial (SnDisplay           *display);
+sn_bool_t         sn_xcb_display_event_is_interesting     (SnDisplay           *display,
+                                                           xcb_generic_event_t *xevent);
 
 void       sn_display_error_trap_push (SnDisplay              *display);
 void       sn_display_error_trap_pop  (SnDisplay              *display);
 
+void       sn_display_set_pending_message_limits (SnDisplay *display,
+                                                  int        max_messages,
+                                                  int        max_age);
+void       sn_display_get_pending_message_stats  (SnDisplay *display,
+                                                  int       *n_pending,
+                                                  int       *n_evicted,
+                                                  int       *n_expired,
+                                                  int       *n_discarded);
+void       sn_display_set_reuse_message_windows  (SnDisplay *display,
+                                                  sn_bool_t  reuse);
+void       sn_display_begin_batch                (SnDisplay *display);
+void       sn_display_end_batch                  (SnDisplay *display);
+void       sn_display_set_defer_dispatch         (SnDisplay *display,
+                                                  sn_bool_t  defer);
+void       sn_display_dispatch_pending           (SnDisplay *display);
+sn_bool_t  sn_display_has_pending                (SnDisplay *display);
+void       sn_display_set_coalesce_changes       (SnDisplay *display,
+                                                  sn_bool_t  coalesce);
+void       sn_display_flush_changes              (SnDisplay *display);
+void       sn_display_set_sequence_timeout       (SnDisplay *display,
+                                                  int        timeout);
+int        sn_display_get_next_timeout           (SnDisplay *display);
+void       sn_display_dispatch_timeouts          (SnDisplay *display);
+void       sn_display_set_early_change_limits    (SnDisplay *display,
+                                                  int        max_bytes,
+                                                  int        max_age);
+void       sn_display_get_string_pool_stats      (SnDisplay *display,
+                                                  int       *n_strings,
+                                                  int       *n_hits,
+                                                  int       *n_misses,
+                                                  int       *bytes_saved);
+
 
 
 SN_END_DECLS
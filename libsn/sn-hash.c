@@ -0,0 +1,316 @@
+/* Hash table abstraction used internally */
+/* 
+ * Copyright (C) 2002 Red Hat, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "sn-hash.h"
+#include "sn-internals.h"
+
+#define MIN_BITS 3
+
+typedef struct SnHashNode
+{
+  void *key;
+  void *value;
+  unsigned int hash_value;
+  struct SnHashNode *next;
+} SnHashNode;
+
+struct SnHash
+{
+  SnHashFunc hash_func;
+  SnEqualFunc equal_func;
+  SnHashNode **buckets;
+  int bits;
+  int n_nodes;
+};
+
+/* Fibonacci hashing; spreads sequential keys such as atoms and
+ * XIDs over the table, and lets us use a power of two size.
+ */
+static unsigned int
+bucket_for_hash (SnHash       *hash,
+                 unsigned int  hash_value)
+{
+  return (hash_value * 2654435769U) >> (32 - hash->bits);
+}
+
+SnHash*
+sn_hash_new (SnHashFunc  hash_func,
+             SnEqualFunc equal_func)
+{
+  SnHash *hash;
+
+  hash = sn_new (SnHash, 1);
+  hash->hash_func = hash_func;
+  hash->equal_func = equal_func;
+  hash->bits = MIN_BITS;
+  hash->n_nodes = 0;
+  hash->buckets = sn_new0 (SnHashNode*, 1 << hash->bits);
+
+  return hash;
+}
+
+void
+sn_hash_free (SnHash *hash)
+{
+  int i;
+
+  for (i = 0; i < (1 << hash->bits); ++i)
+    {
+      SnHashNode *node;
+
+      node = hash->buckets[i];
+      while (node != NULL)
+        {
+          SnHashNode *next = node->next;
+
+          sn_free (node);
+
+          node = next;
+        }
+    }
+
+  sn_free (hash->buckets);
+  sn_free (hash);
+}
+
+static void
+resize (SnHash *hash,
+        int     bits)
+{
+  SnHashNode **old_buckets;
+  int old_size;
+  int i;
+
+  old_buckets = hash->buckets;
+  old_size = 1 << hash->bits;
+
+  hash->bits = bits;
+  hash->buckets = sn_new0 (SnHashNode*, 1 << hash->bits);
+
+  for (i = 0; i < old_size; ++i)
+    {
+      SnHashNode *node;
+
+      node = old_buckets[i];
+      while (node != NULL)
+        {
+          SnHashNode *next = node->next;
+          unsigned int b;
+
+          b = bucket_for_hash (hash, node->hash_value);
+          node->next = hash->buckets[b];
+          hash->buckets[b] = node;
+
+          node = next;
+        }
+    }
+
+  sn_free (old_buckets);
+}
+
+static SnHashNode**
+lookup_node (SnHash       *hash,
+             const void   *key,
+             unsigned int  hash_value)
+{
+  SnHashNode **node_p;
+
+  node_p = &hash->buckets[bucket_for_hash (hash, hash_value)];
+  while (*node_p != NULL)
+    {
+      if ((*node_p)->hash_value == hash_value &&
+          (* hash->equal_func) ((*node_p)->key, key))
+        break;
+
+      node_p = &(*node_p)->next;
+    }
+
+  return node_p;
+}
+
+/* Replaces the value if @key is already present; the old key
+ * pointer is kept in that case.
+ */
+void
+sn_hash_insert (SnHash *hash,
+                void   *key,
+                void   *value)
+{
+  sn_hash_insert_hashed (hash, key, (* hash->hash_func) (key), value);
+}
+
+void*
+sn_hash_lookup (SnHash     *hash,
+                const void *key)
+{
+  return sn_hash_lookup_hashed (hash, key, (* hash->hash_func) (key));
+}
+
+sn_bool_t
+sn_hash_remove (SnHash     *hash,
+                const void *key)
+{
+  return sn_hash_remove_hashed (hash, key, (* hash->hash_func) (key));
+}
+
+/* The _hashed variants take the result of the hash function for
+ * @key, for callers that keep it around.
+ */
+void
+sn_hash_insert_hashed (SnHash       *hash,
+                       void         *key,
+                       unsigned int  hash_value,
+                       void         *value)
+{
+  SnHashNode **node_p;
+  SnHashNode *node;
+
+  node_p = lookup_node (hash, key, hash_value);
+  if (*node_p != NULL)
+    {
+      (*node_p)->value = value;
+      return;
+    }
+
+  node = sn_new (SnHashNode, 1);
+  node->key = key;
+  node->value = value;
+  node->hash_value = hash_value;
+  node->next = *node_p;
+  *node_p = node;
+
+  hash->n_nodes += 1;
+
+  /* Keep the load factor under 1 */
+  if (hash->n_nodes > (1 << hash->bits) && hash->bits < 30)
+    resize (hash, hash->bits + 1);
+}
+
+void*
+sn_hash_lookup_hashed (SnHash       *hash,
+                       const void   *key,
+                       unsigned int  hash_value)
+{
+  SnHashNode *node;
+
+  node = *lookup_node (hash, key, hash_value);
+
+  return node ? node->value : NULL;
+}
+
+sn_bool_t
+sn_hash_remove_hashed (SnHash       *hash,
+                       const void   *key,
+                       unsigned int  hash_value)
+{
+  SnHashNode **node_p;
+  SnHashNode *node;
+
+  node_p = lookup_node (hash, key, hash_value);
+  if (*node_p == NULL)
+    return FALSE;
+
+  node = *node_p;
+  *node_p = node->next;
+  sn_free (node);
+
+  hash->n_nodes -= 1;
+
+  /* We never shrink, so that removing from inside
+   * sn_hash_foreach() is safe.
+   */
+
+  return TRUE;
+}
+
+/* @func may remove the entry it is called for, but must not
+ * otherwise modify the table.
+ */
+void
+sn_hash_foreach (SnHash            *hash,
+                 SnHashForeachFunc  func,
+                 void              *data)
+{
+  int i;
+
+  for (i = 0; i < (1 << hash->bits); ++i)
+    {
+      SnHashNode *node;
+
+      node = hash->buckets[i];
+      while (node != NULL)
+        {
+          SnHashNode *next = node->next; /* reentrancy safety */
+
+          if (!(* func) (node->key, node->value, data))
+            return;
+
+          node = next;
+        }
+    }
+}
+
+int
+sn_hash_size (SnHash *hash)
+{
+  return hash->n_nodes;
+}
+
+unsigned int
+sn_direct_hash (const void *key)
+{
+  return SN_POINTER_TO_UINT (key);
+}
+
+sn_bool_t
+sn_direct_equal (const void *a,
+                 const void *b)
+{
+  return a == b;
+}
+
+/* FNV-1a */
+unsigned int
+sn_string_hash (const void *key)
+{
+  const unsigned char *p;
+  unsigned int h;
+
+  h = 2166136261U;
+  for (p = key; *p; ++p)
+    {
+      h ^= *p;
+      h *= 16777619U;
+    }
+
+  return h;
+}
+
+sn_bool_t
+sn_string_equal (const void *a,
+                 const void *b)
+{
+  return strcmp (a, b) == 0;
+}
@@ -0,0 +1,81 @@
+/* Hash table abstraction used internally */
+/* 
+ * Copyright (C) 2002 Red Hat, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __SN_HASH_H__
+#define __SN_HASH_H__
+
+#include <libsn/sn-util.h>
+
+SN_BEGIN_DECLS
+
+typedef struct SnHash SnHash;
+
+typedef unsigned int (* SnHashFunc)        (const void *key);
+typedef sn_bool_t    (* SnEqualFunc)       (const void *a,
+                                            const void *b);
+typedef sn_bool_t    (* SnHashForeachFunc) (void       *key,
+                                            void       *value,
+                                            void       *data);
+
+#define SN_POINTER_TO_UINT(p) ((unsigned int) (unsigned long) (p))
+#define SN_UINT_TO_POINTER(u) ((void*) (unsigned long) (u))
+
+SnHash*   sn_hash_new     (SnHashFunc         hash_func,
+                           SnEqualFunc        equal_func);
+void      sn_hash_free    (SnHash            *hash);
+void      sn_hash_insert  (SnHash            *hash,
+                           void              *key,
+                           void              *value);
+void*     sn_hash_lookup  (SnHash            *hash,
+                           const void        *key);
+sn_bool_t sn_hash_remove  (SnHash            *hash,
+                           const void        *key);
+void      sn_hash_foreach (SnHash            *hash,
+                           SnHashForeachFunc  func,
+                           void              *data);
+int       sn_hash_size    (SnHash            *hash);
+
+void      sn_hash_insert_hashed (SnHash       *hash,
+                                 void         *key,
+                                 unsigned int  hash_value,
+                                 void         *value);
+void*     sn_hash_lookup_hashed (SnHash       *hash,
+                                 const void   *key,
+                                 unsigned int  hash_value);
+sn_bool_t sn_hash_remove_hashed (SnHash       *hash,
+                                 const void   *key,
+                                 unsigned int  hash_value);
+
+unsigned int sn_direct_hash  (const void *key);
+sn_bool_t    sn_direct_equal (const void *a,
+                              const void *b);
+unsigned int sn_string_hash  (const void *key);
+sn_bool_t    sn_string_equal (const void *a,
+                              const void *b);
+
+SN_END_DECLS
+
+#endif /* __SN_HASH_H__ */
@@ -0,0 +1,131 @@
+/* 
+ * Copyright (C) 2002 Red Hat, Inc.
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <config.h>
+#include "sn-internals.h"
+
+/* Names of the keys and message types in the startup notification
+ * protocol. Lookups switch on the length and, where two names share
+ * a length, the first byte, then check the one candidate left, so
+ * unknown keys such as "X-" ones are rejected after one comparison.
+ */
+
+static const char * const key_names[SN_KEY_LAST] = {
+  NULL,
+  "ID",
+  "NAME",
+  "SCREEN",
+  "BIN",
+  "ICON",
+  "DESKTOP",
+  "TIMESTAMP",
+  "DESCRIPTION",
+  "WMCLASS",
+  "APPLICATION_ID"
+};
+
+static const char * const message_type_names[SN_MESSAGE_LAST] = {
+  NULL,
+  "new",
+  "change",
+  "remove"
+};
+
+SnKey
+sn_internal_lookup_key (const char *name,
+                        int         len)
+{
+  SnKey key;
+
+  switch (len)
+    {
+    case 2:
+      key = SN_KEY_ID;
+      break;
+    case 3:
+      key = SN_KEY_BIN;
+      break;
+    case 4:
+      key = name[0] == 'N' ? SN_KEY_NAME : SN_KEY_ICON;
+      break;
+    case 6:
+      key = SN_KEY_SCREEN;
+      break;
+    case 7:
+      key = name[0] == 'D' ? SN_KEY_DESKTOP : SN_KEY_WMCLASS;
+      break;
+    case 9:
+      key = SN_KEY_TIMESTAMP;
+      break;
+    case 11:
+      key = SN_KEY_DESCRIPTION;
+      break;
+    case 14:
+      key = SN_KEY_APPLICATION_ID;
+      break;
+    default:
+      return SN_KEY_UNKNOWN;
+    }
+
+  if (memcmp (name, key_names[key], len) != 0)
+    return SN_KEY_UNKNOWN;
+
+  return key;
+}
+
+const char*
+sn_internal_key_name (SnKey key)
+{
+  return key_names[key];
+}
+
+SnMessageType
+sn_internal_lookup_message_type (const char *prefix,
+                                 int         len)
+{
+  SnMessageType type;
+
+  switch (len)
+    {
+    case 3:
+      type = SN_MESSAGE_NEW;
+      break;
+    case 6:
+      type = prefix[0] == 'c' ? SN_MESSAGE_CHANGE : SN_MESSAGE_REMOVE;
+      break;
+    default:
+      return SN_MESSAGE_UNKNOWN;
+    }
+
+  if (memcmp (prefix, message_type_names[type], len) != 0)
+    return SN_MESSAGE_UNKNOWN;
+
+  return type;
+}
+
+const char*
+sn_internal_message_type_name (SnMessageType type)
+{
+  return message_type_names[type];
+}
@@ -33,6 +33,7 @@
 #include <string.h>
 
 #include <libsn/sn-list.h>
+#include <libsn/sn-hash.h>
 #include <libsn/sn-xutils.h>
 
 SN_BEGIN_DECLS
@@ -49,6 +50,41 @@ SN_BEGIN_DECLS
 #define NULL ((void*) 0)
 #endif
 
+/* Per-display state owned by sn-xmessages.c */
+typedef struct SnXmessageData SnXmessageData;
+
+/* Per-display state owned by sn-monitor.c */
+typedef struct SnMonitorData SnMonitorData;
+
+/* An interned atom, resolved on first use */
+typedef struct SnLazyAtom SnLazyAtom;
+
+/* Keys and message types of the startup notification protocol */
+typedef enum
+{
+  SN_KEY_UNKNOWN,
+  SN_KEY_ID,
+  SN_KEY_NAME,
+  SN_KEY_SCREEN,
+  SN_KEY_BIN,
+  SN_KEY_ICON,
+  SN_KEY_DESKTOP,
+  SN_KEY_TIMESTAMP,
+  SN_KEY_DESCRIPTION,
+  SN_KEY_WMCLASS,
+  SN_KEY_APPLICATION_ID,
+  SN_KEY_LAST
+} SnKey;
+
+typedef enum
+{
+  SN_MESSAGE_UNKNOWN,
+  SN_MESSAGE_NEW,
+  SN_MESSAGE_CHANGE,
+  SN_MESSAGE_REMOVE,
+  SN_MESSAGE_LAST
+} SnMessageType;
+
 /* --- From sn-common.c --- */
 xcb_screen_t* sn_internal_display_get_x_screen (SnDisplay              *display,
                                                 int                     number);
@@ -60,24 +96,61 @@ int        sn_internal_display_get_screen_number (SnDisplay *display);
 
 void*      sn_internal_display_get_id (SnDisplay *display);
 
-void       sn_internal_display_get_xmessage_data (SnDisplay              *display,
-                                                  SnList                **funcs,
-                                                  SnList                **pending);
+SnXmessageData* sn_internal_display_get_xmessage_data (SnDisplay *display);
+SnMonitorData*  sn_internal_display_get_monitor_data  (SnDisplay *display);
+
+SnLazyAtom* sn_internal_display_intern_atom (SnDisplay  *display,
+                                             const char *name);
+xcb_atom_t  sn_internal_display_get_atom    (SnDisplay  *display,
+                                             SnLazyAtom *atom);
+
+const char* sn_internal_display_intern_string  (SnDisplay  *display,
+                                                const char *str);
+void        sn_internal_display_release_string (SnDisplay  *display,
+                                                const char *str);
 
 xcb_atom_t sn_internal_get_utf8_string_atom(SnDisplay *display);
 
 xcb_atom_t sn_internal_get_net_startup_id_atom(SnDisplay *display);
 
+xcb_atom_t sn_internal_get_wm_client_leader_atom(SnDisplay *display);
+
 xcb_atom_t sn_internal_get_net_startup_info_atom(SnDisplay *display);
 
 xcb_atom_t sn_internal_get_net_startup_info_begin_atom(SnDisplay *display);
 
+/* --- From sn-internals.c --- */
+SnKey         sn_internal_lookup_key          (const char    *name,
+                                               int            len);
+const char*   sn_internal_key_name            (SnKey          key);
+SnMessageType sn_internal_lookup_message_type (const char    *prefix,
+                                               int            len);
+const char*   sn_internal_message_type_name   (SnMessageType  type);
+
 /* --- From sn-monitor.c --- */
+SnMonitorData* sn_internal_monitor_data_new  (void);
+void           sn_internal_monitor_data_free (SnMonitorData *monitor_data);
 sn_bool_t sn_internal_monitor_process_event (SnDisplay *display);
+void      sn_internal_monitor_set_sequence_timeout (SnDisplay *display,
+                                                    int        timeout);
+int       sn_internal_monitor_get_next_timeout     (SnDisplay *display);
+void      sn_internal_monitor_dispatch_timeouts    (SnDisplay *display);
+void      sn_internal_monitor_set_early_change_limits (SnDisplay *display,
+                                                       int        max_bytes,
+                                                       int        max_age);
+void      sn_internal_monitor_set_coalesce_changes (SnDisplay *display,
+                                                    sn_bool_t  coalesce);
+void      sn_internal_monitor_flush_changes        (SnDisplay *display);
+void      sn_internal_monitor_set_defer_dispatch   (SnDisplay *display,
+                                                    sn_bool_t  defer);
+void      sn_internal_monitor_dispatch_pending     (SnDisplay *display);
+sn_bool_t sn_internal_monitor_has_pending          (SnDisplay *display);
 
 /* --- From sn-util.c --- */
 sn_bool_t sn_internal_utf8_validate (const char *str,
                                      int         max_len);
+sn_bool_t sn_internal_utf8_to_latin1 (const char *str,
+                                      char       *latin1);
 char*     sn_internal_strdup        (const char *str);
 char*     sn_internal_strndup       (const char *str,
                                      int         n);
@@ -85,6 +158,8 @@ void      sn_internal_strfreev      (char      **strings);
 
 unsigned long sn_internal_string_to_ulong (const char* str);
 
+unsigned long sn_internal_get_monotonic_msec (void);
+
 char*     sn_internal_find_last_occurrence (const char* haystack, 
                                             const char* needle);
 
@@ -93,10 +168,39 @@ void sn_internal_append_to_string (char      **append_to,
                                    const char *append);
 
 /* --- From sn-xmessages.c --- */
+SnXmessageData* sn_internal_xmessage_data_new  (void);
+void            sn_internal_xmessage_data_free (SnXmessageData *xmessage_data);
+void            sn_internal_xmessage_set_pending_limits (SnXmessageData *xmessage_data,
+                                                         int             max_messages,
+                                                         int             max_age);
+void            sn_internal_xmessage_get_pending_stats  (SnXmessageData *xmessage_data,
+                                                         int            *n_pending,
+                                                         int            *n_evicted,
+                                                         int            *n_expired,
+                                                         int            *n_discarded);
+void            sn_internal_xmessage_set_reuse_windows  (SnDisplay      *display,
+                                                         sn_bool_t       reuse);
+void            sn_internal_xmessage_begin_batch        (SnDisplay      *display);
+void            sn_internal_xmessage_end_batch          (SnDisplay      *display);
+void            sn_internal_xmessage_release_windows    (SnDisplay      *display);
+int             sn_internal_xmessage_get_next_timeout   (SnDisplay      *display);
+void            sn_internal_xmessage_dispatch_timeouts  (SnDisplay      *display);
+
 sn_bool_t sn_internal_xmessage_process_client_message (SnDisplay  *display,
                                                        xcb_window_t window,
                                                        xcb_atom_t   type,
                                                        const char  *data);
+int       sn_internal_xmessage_process_events        (SnDisplay            *display,
+                                                       xcb_generic_event_t **events,
+                                                       int                   n_events,
+                                                       unsigned char        *handled_mask);
+const xcb_atom_t* sn_internal_xmessage_get_interesting_atoms (SnDisplay    *display,
+                                                              int          *n_atoms,
+                                                              unsigned int *serial);
+unsigned int      sn_internal_xmessage_get_interesting_atoms_serial (SnDisplay *display);
+sn_bool_t         sn_internal_xmessage_event_is_interesting  (SnDisplay    *display,
+                                                              xcb_window_t  window,
+                                                              xcb_atom_t    type);
 
 SN_END_DECLS
 
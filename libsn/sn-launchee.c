@@ -181,26 +181,21 @@ sn_launchee_context_get_timestamp (SnLauncheeContext *context)
 void
 sn_launchee_context_complete (SnLauncheeContext *context)
 {
-  char *keys[2];
-  char *vals[2];
-  char *message;
+  const char *keys[2];
+  const char *vals[2];
   
-  keys[0] = "ID";
+  keys[0] = sn_internal_key_name (SN_KEY_ID);
   keys[1] = NULL;
   vals[0] = context->startup_id;
   vals[1] = NULL; 
 
-  message = sn_internal_serialize_message ("remove",
-                                           (const char**) keys,
-                                           (const char**) vals);
-
-  sn_internal_broadcast_xmessage (context->display,
-                                  context->screen,
-                                  sn_internal_get_net_startup_info_atom(context->display),
-                                  sn_internal_get_net_startup_info_begin_atom(context->display),
-                                  message);
-
-  sn_free (message);
+  sn_internal_broadcast_message (context->display,
+                                 context->screen,
+                                 sn_internal_get_net_startup_info_atom(context->display),
+                                 sn_internal_get_net_startup_info_begin_atom(context->display),
+                                 sn_internal_message_type_name (SN_MESSAGE_REMOVE),
+                                 keys,
+                                 vals);
 }
 
 /**
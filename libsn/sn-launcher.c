@@ -176,9 +176,8 @@ sn_launcher_context_initiate (SnLauncherContext *context,
   char *canonicalized_launchee;
   int i;
 #define MAX_PROPS 12
-  char *names[MAX_PROPS];
-  char *values[MAX_PROPS];  
-  char *message;
+  const char *names[MAX_PROPS];
+  const char *values[MAX_PROPS];  
   char workspacebuf[257];
   char screenbuf[257];
   
@@ -218,32 +217,32 @@ sn_launcher_context_initiate (SnLauncherContext *context,
   
   i = 0;
 
-  names[i] = "ID";
+  names[i] = sn_internal_key_name (SN_KEY_ID);
   values[i] = context->startup_id;
   ++i;  
 
-  names[i] = "SCREEN";
+  names[i] = sn_internal_key_name (SN_KEY_SCREEN);
   sprintf (screenbuf, "%d", context->screen);
   values[i] = screenbuf;
   ++i;
   
   if (context->name != NULL)
     {
-      names[i] = "NAME";
+      names[i] = sn_internal_key_name (SN_KEY_NAME);
       values[i] = context->name;
       ++i;
     }
 
   if (context->description != NULL)
     {
-      names[i] = "DESCRIPTION";
+      names[i] = sn_internal_key_name (SN_KEY_DESCRIPTION);
       values[i] = context->description;
       ++i;
     }
 
   if (context->workspace >= 0)
     {
-      names[i] = "DESKTOP";
+      names[i] = sn_internal_key_name (SN_KEY_DESKTOP);
       sprintf (workspacebuf, "%d", context->workspace);
       values[i] = workspacebuf;
       ++i;
@@ -251,28 +250,28 @@ sn_launcher_context_initiate (SnLauncherContext *context,
 
   if (context->wmclass != NULL)
     {
-      names[i] = "WMCLASS";
+      names[i] = sn_internal_key_name (SN_KEY_WMCLASS);
       values[i] = context->wmclass;
       ++i;
     }
 
   if (context->binary_name != NULL)
     {
-      names[i] = "BIN";
+      names[i] = sn_internal_key_name (SN_KEY_BIN);
       values[i] = context->binary_name;
       ++i;
     }
 
   if (context->icon_name != NULL)
     {
-      names[i] = "ICON";
+      names[i] = sn_internal_key_name (SN_KEY_ICON);
       values[i] = context->icon_name;
       ++i;
     }
 
   if (context->application_id != NULL)
     {
-      names[i] = "APPLICATION_ID";
+      names[i] = sn_internal_key_name (SN_KEY_APPLICATION_ID);
       values[i] = context->application_id;
       ++i;
     }
@@ -284,25 +283,20 @@ sn_launcher_context_initiate (SnLauncherContext *context,
 
   gettimeofday (&context->initiation_time, NULL);
   
-  message = sn_internal_serialize_message ("new",
-                                           (const char**) names,
-                                           (const char**) values);
-  
-  sn_internal_broadcast_xmessage (context->display,
-                                  context->screen,
-                                  sn_internal_get_net_startup_info_atom(context->display),
-                                  sn_internal_get_net_startup_info_begin_atom(context->display),
-                                  message);
-
-  sn_free (message);
+  sn_internal_broadcast_message (context->display,
+                                 context->screen,
+                                 sn_internal_get_net_startup_info_atom(context->display),
+                                 sn_internal_get_net_startup_info_begin_atom(context->display),
+                                 sn_internal_message_type_name (SN_MESSAGE_NEW),
+                                 names,
+                                 values);
 }
 
 void
 sn_launcher_context_complete (SnLauncherContext *context)
 {
-  char *keys[2];
-  char *vals[2];
-  char *message;
+  const char *keys[2];
+  const char *vals[2];
 
   if (context->startup_id == NULL)
     {
@@ -311,22 +305,18 @@ sn_launcher_context_complete (SnLauncherContext *context)
       return;
     }
   
-  keys[0] = "ID";
+  keys[0] = sn_internal_key_name (SN_KEY_ID);
   keys[1] = NULL;
   vals[0] = context->startup_id;
   vals[1] = NULL; 
 
-  message = sn_internal_serialize_message ("remove",
-                                           (const char**) keys,
-                                           (const char **) vals);
-
-  sn_internal_broadcast_xmessage (context->display,
-                                  context->screen,
-                                  sn_internal_get_net_startup_info_atom(context->display),
-                                  sn_internal_get_net_startup_info_begin_atom(context->display),
-                                  message);
-
-  sn_free (message);
+  sn_internal_broadcast_message (context->display,
+                                 context->screen,
+                                 sn_internal_get_net_startup_info_atom(context->display),
+                                 sn_internal_get_net_startup_info_begin_atom(context->display),
+                                 sn_internal_message_type_name (SN_MESSAGE_REMOVE),
+                                 keys,
+                                 vals);
 }
 
 const char*
@@ -38,6 +38,9 @@ struct SnMonitorContext
    * started prior to context creation
    */
   int creation_serial;  
+  /* links in the display's list of contexts */
+  SnMonitorContext *next;
+  SnMonitorContext *prev;
 };
 
 struct SnMonitorEvent
@@ -46,6 +49,12 @@ struct SnMonitorEvent
   SnMonitorEventType type;
   SnMonitorContext *context;
   SnStartupSequence *sequence;
+  /* SnStartupSequenceField bits */
+  unsigned int changed_fields;
+  /* link in the display's list of free events, or of
+   * deferred events
+   */
+  SnMonitorEvent *next;
 };
 
 struct SnStartupSequence
@@ -56,37 +65,205 @@ struct SnStartupSequence
   int screen;
 
   char *id;
+  /* sn_string_hash() of id, for the sequences_by_id index */
+  unsigned int id_hash;
   
-  char *name;
+  /* name, wmclass, binary_name, icon_name and application_id
+   * are interned with sn_internal_display_intern_string()
+   */
+  const char *name;
   char *description;
 
-  char *wmclass;
+  const char *wmclass;
 
   int workspace;
   Time timestamp;
 
-  char *binary_name;
-  char *icon_name;
-  char *application_id;
+  const char *binary_name;
+  const char *icon_name;
+  const char *application_id;
 
   unsigned int completed : 1;
   unsigned int canceled : 1;
   unsigned int timestamp_set : 1;
+  unsigned int change_queued : 1;
   
   int creation_serial;
+  /* bumped whenever a field changes */
+  unsigned int generation;
+  /* fields changed since the last CHANGED event, when coalescing,
+   * and link in the display's queue of such sequences
+   */
+  unsigned int pending_changed_fields;
+  SnStartupSequence *next_changed;
+  SnStartupSequence *prev_changed;
 
   struct timeval initiation_time;
+  /* sn_internal_get_monotonic_msec() at the same moment, which the
+   * timeout is measured from
+   */
+  unsigned long initiation_msec;
+
+  /* links in the display's list of live sequences, oldest first */
+  SnStartupSequence *newer;
+  SnStartupSequence *older;
+
+  /* wmclass in Latin-1, which is wmclass itself when that is ASCII
+   * and a copy owned by the sequence otherwise, and links in the
+   * list of live sequences with the same one, oldest first
+   */
+  const char *wmclass_latin1;
+  unsigned int wmclass_hash;
+  SnStartupSequence *wmclass_prev;
+  SnStartupSequence *wmclass_next;
+
+  /* id points here; the sequence is allocated with room for it.
+   * Only the ID lives in this block: description and a non-ASCII
+   * wmclass_latin1 are allocated on their own, since "change:"
+   * messages can replace them, and the other strings are pooled.
+   */
+  char id_storage[1];
+};
+
+/* Freed events kept per display for reuse */
+#define MAX_FREE_EVENTS 16
+
+/* Sequences that haven't completed this long after they were
+ * initiated are canceled by sn_display_dispatch_timeouts()
+ */
+#define DEFAULT_SEQUENCE_TIMEOUT 15000 /* milliseconds */
+
+/* The spec asks for "change:" data that arrives before "new:" to be
+ * kept for at least a minute
+ */
+#define DEFAULT_MAX_EARLY_CHANGE_BYTES 16384
+#define DEFAULT_EARLY_CHANGE_TIMEOUT 60000 /* milliseconds */
+
+typedef struct SnEarlyChange SnEarlyChange;
+
+/* The "change:" messages received for a startup ID before its "new:" */
+struct SnEarlyChange
+{
+  char *id;
+  unsigned int id_hash;
+  char **messages;
+  int n_messages;
+  /* bytes counted against max_early_change_bytes */
+  int size;
+  /* sn_internal_get_monotonic_msec() when the first message arrived */
+  unsigned long received;
+  SnEarlyChange *newer;
+  SnEarlyChange *older;
 };
 
-static SnList *context_list = NULL;
-static SnList *sequence_list = NULL;
-static int next_sequence_serial = 0;
+/* Monitor state for one display */
+struct SnMonitorData
+{
+  SnMonitorContext *contexts;
+  SnMonitorEvent *free_events;
+  int n_free_events;
+  /* Live sequences, each holding a ref, by startup ID */
+  SnHash *sequences_by_id;
+  int next_sequence_serial;
+  /* The oldest live sequence for each Latin-1 wmclass */
+  SnHash *sequences_by_wmclass;
+
+  /* Since every sequence gets the same timeout, the order they
+   * were initiated in is also the order they expire in
+   */
+  SnStartupSequence *oldest_sequence;
+  SnStartupSequence *newest_sequence;
+  int sequence_timeout;
+
+  /* Early "change:" messages by startup ID, and ordered from
+   * oldest to newest
+   */
+  SnHash *early_changes;
+  SnEarlyChange *oldest_early_change;
+  SnEarlyChange *newest_early_change;
+  int early_change_bytes;
+
+  int max_early_change_bytes;
+  int early_change_timeout;
+
+  /* Sequences with a CHANGED event held back until
+   * sn_display_flush_changes(), each holding a ref
+   */
+  sn_bool_t coalesce_changes;
+  SnStartupSequence *first_changed;
+  SnStartupSequence *last_changed;
+
+  /* Events waiting for sn_display_dispatch_pending(), each
+   * holding a ref
+   */
+  sn_bool_t defer_dispatch;
+  SnMonitorEvent *first_deferred;
+  SnMonitorEvent *last_deferred;
+};
 
 static void xmessage_func (SnDisplay       *display,
                            const char      *message_type,
                            const char      *message,
+                           int              message_len,
                            void            *user_data);
 
+SnMonitorData*
+sn_internal_monitor_data_new (void)
+{
+  SnMonitorData *monitor_data;
+
+  monitor_data = sn_new0 (SnMonitorData, 1);
+
+  monitor_data->contexts = NULL;
+  monitor_data->sequences_by_id = sn_hash_new (sn_string_hash,
+                                              sn_string_equal);
+  monitor_data->next_sequence_serial = 0;
+  monitor_data->sequences_by_wmclass = sn_hash_new (sn_string_hash,
+                                                   sn_string_equal);
+  monitor_data->sequence_timeout = DEFAULT_SEQUENCE_TIMEOUT;
+  monitor_data->early_changes = sn_hash_new (sn_string_hash,
+                                            sn_string_equal);
+  monitor_data->max_early_change_bytes = DEFAULT_MAX_EARLY_CHANGE_BYTES;
+  monitor_data->early_change_timeout = DEFAULT_EARLY_CHANGE_TIMEOUT;
+
+  return monitor_data;
+}
+
+static void early_change_free          (SnEarlyChange *early_change);
+static int  get_early_change_remaining (SnMonitorData *monitor_data,
+                                        SnEarlyChange *early_change,
+                                        unsigned long  now);
+static void evict_early_changes        (SnMonitorData *monitor_data,
+                                        unsigned long  now);
+
+void
+sn_internal_monitor_data_free (SnMonitorData *monitor_data)
+{
+  /* Contexts, sequences and events hold a ref on the display,
+   * so only free events are left by the time the display is freed
+   */
+  while (monitor_data->free_events != NULL)
+    {
+      SnMonitorEvent *event = monitor_data->free_events;
+
+      monitor_data->free_events = event->next;
+      sn_free (event);
+    }
+
+  while (monitor_data->oldest_early_change != NULL)
+    {
+      SnEarlyChange *early_change = monitor_data->oldest_early_change;
+
+      monitor_data->oldest_early_change = early_change->newer;
+      early_change_free (early_change);
+    }
+
+  sn_hash_free (monitor_data->sequences_by_id);
+  sn_hash_free (monitor_data->sequences_by_wmclass);
+  sn_hash_free (monitor_data->early_changes);
+  sn_free (monitor_data);
+}
+
 /**
  * sn_monitor_context_new:
  * @display: an #SnDisplay
@@ -116,6 +293,7 @@ sn_monitor_context_new (SnDisplay           *display,
                         SnFreeFunc           free_data_func)
 {
   SnMonitorContext *context;
+  SnMonitorData *monitor_data;
   
   context = sn_new0 (SnMonitorContext, 1);
 
@@ -128,10 +306,9 @@ sn_monitor_context_new (SnDisplay           *display,
   sn_display_ref (context->display);
   context->screen = screen;
   
-  if (context_list == NULL)
-    context_list = sn_list_new ();
+  monitor_data = sn_internal_display_get_monitor_data (display);
 
-  if (sn_list_empty (context_list))
+  if (monitor_data->contexts == NULL)
     sn_internal_add_xmessage_func (display,
                                    screen,
                                    "_NET_STARTUP_INFO",
@@ -139,10 +316,13 @@ sn_monitor_context_new (SnDisplay           *display,
                                    xmessage_func,
                                    NULL, NULL);
     
-  sn_list_prepend (context_list, context);
+  context->next = monitor_data->contexts;
+  if (context->next)
+    context->next->prev = context;
+  monitor_data->contexts = context;
 
   /* We get events for serials >= creation_serial */
-  context->creation_serial = next_sequence_serial;
+  context->creation_serial = monitor_data->next_sequence_serial;
   
   return context;
 }
@@ -174,9 +354,18 @@ sn_monitor_context_unref (SnMonitorContext *context)
 
   if (context->refcount == 0)
     {
-      sn_list_remove (context_list, context);
+      SnMonitorData *monitor_data;
+
+      monitor_data = sn_internal_display_get_monitor_data (context->display);
+
+      if (context->prev)
+        context->prev->next = context->next;
+      else
+        monitor_data->contexts = context->next;
+      if (context->next)
+        context->next->prev = context->prev;
 
-      if (sn_list_empty (context_list))
+      if (monitor_data->contexts == NULL)
         sn_internal_remove_xmessage_func (context->display,
                                           context->screen,
                                           "_NET_STARTUP_INFO",
@@ -191,6 +380,82 @@ sn_monitor_context_unref (SnMonitorContext *context)
     }
 }
 
+/**
+ * sn_monitor_context_foreach_sequence:
+ * @context: an #SnMonitorContext
+ * @func: function to call for each sequence
+ * @data: data to pass to @func
+ *
+ * Calls @func for each startup sequence on the display and screen of
+ * @context that hasn't completed yet and that @context would get
+ * events for, in the order the sequences were initiated. Iteration
+ * stops early if @func returns %FALSE. Sequences that complete while
+ * iterating may end the iteration.
+ **/
+void
+sn_monitor_context_foreach_sequence (SnMonitorContext              *context,
+                                     SnStartupSequenceForeachFunc   func,
+                                     void                          *data)
+{
+  SnStartupSequence *sequence;
+
+  sequence = sn_internal_display_get_monitor_data (context->display)->oldest_sequence;
+  if (sequence)
+    sn_startup_sequence_ref (sequence);
+
+  while (sequence != NULL)
+    {
+      SnStartupSequence *next;
+
+      if (sequence->creation_serial >= context->creation_serial &&
+          sequence->screen == context->screen &&
+          !sequence->completed &&
+          !sequence->canceled)
+        {
+          if (!(* func) (sequence, data))
+            {
+              sn_startup_sequence_unref (sequence);
+              break;
+            }
+        }
+
+      next = sequence->newer;
+      if (next)
+        sn_startup_sequence_ref (next);
+      sn_startup_sequence_unref (sequence);
+      sequence = next;
+    }
+}
+
+static SnMonitorEvent*
+monitor_event_new (SnMonitorEventType  type,
+                   SnStartupSequence  *sequence)
+{
+  SnMonitorData *monitor_data;
+  SnMonitorEvent *event;
+
+  monitor_data = sn_internal_display_get_monitor_data (sequence->display);
+
+  if (monitor_data->free_events != NULL)
+    {
+      event = monitor_data->free_events;
+      monitor_data->free_events = event->next;
+      monitor_data->n_free_events -= 1;
+    }
+  else
+    event = sn_new (SnMonitorEvent, 1);
+
+  event->refcount = 1;
+  event->type = type;
+  event->context = NULL;
+  event->sequence = sequence;
+  sn_startup_sequence_ref (sequence);
+  event->changed_fields = 0;
+  event->next = NULL;
+
+  return event;
+}
+
 void
 sn_monitor_event_ref (SnMonitorEvent *event)
 {
@@ -204,11 +469,26 @@ sn_monitor_event_unref (SnMonitorEvent *event)
 
   if (event->refcount == 0)
     {
-      if (event->context)
-        sn_monitor_context_unref (event->context);
-      if (event->sequence)
-        sn_startup_sequence_unref (event->sequence);
-      sn_free (event);
+      SnMonitorContext *context = event->context;
+      SnStartupSequence *sequence = event->sequence;
+      SnMonitorData *monitor_data;
+
+      /* Recycle the event while the sequence still keeps the
+       * display alive
+       */
+      monitor_data = sn_internal_display_get_monitor_data (sequence->display);
+      if (monitor_data->n_free_events < MAX_FREE_EVENTS)
+        {
+          event->next = monitor_data->free_events;
+          monitor_data->free_events = event;
+          monitor_data->n_free_events += 1;
+        }
+      else
+        sn_free (event);
+
+      if (context)
+        sn_monitor_context_unref (context);
+      sn_startup_sequence_unref (sequence);
     }
 }
 
@@ -217,17 +497,12 @@ sn_monitor_event_copy (SnMonitorEvent *event)
 {
   SnMonitorEvent *copy;
 
-  copy = sn_new0 (SnMonitorEvent, 1);
+  copy = monitor_event_new (event->type, event->sequence);
+  copy->changed_fields = event->changed_fields;
 
-  copy->refcount = 1;
-
-  copy->type = event->type;
   copy->context = event->context;
   if (copy->context)
     sn_monitor_context_ref (copy->context);
-  copy->sequence = event->sequence;
-  if (copy->sequence)
-    sn_startup_sequence_ref (copy->sequence);
   
   return copy;
 }
@@ -238,6 +513,23 @@ sn_monitor_event_get_type (SnMonitorEvent *event)
   return event->type;
 }
 
+/**
+ * sn_monitor_event_get_changed_fields:
+ * @event: an #SnMonitorEvent
+ *
+ * Gets the fields of the event's sequence the event is about. For
+ * %SN_MONITOR_EVENT_CHANGED these are the fields that changed; for
+ * %SN_MONITOR_EVENT_INITIATED, every field the sequence started
+ * with. Other events have none.
+ *
+ * Return value: a mask of #SnStartupSequenceField values
+ **/
+unsigned int
+sn_monitor_event_get_changed_fields (SnMonitorEvent *event)
+{
+  return event->changed_fields;
+}
+
 SnStartupSequence*
 sn_monitor_event_get_startup_sequence (SnMonitorEvent *event)
 {
@@ -263,14 +555,17 @@ sn_startup_sequence_unref (SnStartupSequence *sequence)
 
   if (sequence->refcount == 0)
     {      
-      sn_free (sequence->id);
-
-      sn_free (sequence->name);
+      sn_internal_display_release_string (sequence->display,
+                                          sequence->name);
       sn_free (sequence->description);
-      sn_free (sequence->wmclass);
-      sn_free (sequence->binary_name);
-      sn_free (sequence->icon_name);
-      sn_free (sequence->application_id);
+      sn_internal_display_release_string (sequence->display,
+                                          sequence->wmclass);
+      sn_internal_display_release_string (sequence->display,
+                                          sequence->binary_name);
+      sn_internal_display_release_string (sequence->display,
+                                          sequence->icon_name);
+      sn_internal_display_release_string (sequence->display,
+                                          sequence->application_id);
 
       sn_display_unref (sequence->display);
       sn_free (sequence);
@@ -351,6 +646,21 @@ sn_startup_sequence_get_screen (SnStartupSequence *sequence)
   return sequence->screen;
 }
 
+/**
+ * sn_startup_sequence_get_generation:
+ * @sequence: an #SnStartupSequence
+ *
+ * Gets a counter that changes whenever any field of @sequence does,
+ * so clients can tell whether what they derived from it is stale.
+ *
+ * Return value: the generation
+ **/
+unsigned int
+sn_startup_sequence_get_generation (SnStartupSequence *sequence)
+{
+  return sequence->generation;
+}
+
 /**
  * sn_startup_sequence_get_initiated_time:
  * @sequence: an #SnStartupSequence
@@ -399,9 +709,8 @@ sn_startup_sequence_get_last_active_time (SnStartupSequence *sequence,
 void
 sn_startup_sequence_complete (SnStartupSequence *sequence)
 {
-  char *keys[2];
-  char *vals[2];
-  char *message;
+  const char *keys[2];
+  const char *vals[2];
 
   if (sequence->id == NULL)
     return;
@@ -409,38 +718,42 @@ sn_startup_sequence_complete (SnStartupSequence *sequence)
   if (sequence->screen < 0)
     return;
   
-  keys[0] = "ID";
+  keys[0] = sn_internal_key_name (SN_KEY_ID);
   keys[1] = NULL;
   vals[0] = sequence->id;
   vals[1] = NULL; 
 
-  message = sn_internal_serialize_message ("remove",
-                                           (const char**) keys,
-                                           (const char **) vals);
-
-  sn_internal_broadcast_xmessage (sequence->display,
-                                  sequence->screen,
-                                  sn_internal_get_net_startup_info_atom(sequence->display),
-                                  sn_internal_get_net_startup_info_begin_atom(sequence->display),
-                                  message);
-
-  sn_free (message);
+  sn_internal_broadcast_message (sequence->display,
+                                 sequence->screen,
+                                 sn_internal_get_net_startup_info_atom(sequence->display),
+                                 sn_internal_get_net_startup_info_begin_atom(sequence->display),
+                                 sn_internal_message_type_name (SN_MESSAGE_REMOVE),
+                                 keys,
+                                 vals);
 
 }
 
 static SnStartupSequence*
-sn_startup_sequence_new (SnDisplay *display)
+sn_startup_sequence_new (SnDisplay  *display,
+                         const char *id)
 {
   SnStartupSequence *sequence;
-  
-  sequence = sn_new0 (SnStartupSequence, 1);
+  SnMonitorData *monitor_data;
+  int id_len;
+
+  id_len = strlen (id);
+  sequence = sn_malloc0 (sizeof (SnStartupSequence) + id_len);
 
   sequence->refcount = 1;
 
-  sequence->creation_serial = next_sequence_serial;
-  ++next_sequence_serial;
+  monitor_data = sn_internal_display_get_monitor_data (display);
+  sequence->creation_serial = monitor_data->next_sequence_serial;
+  ++monitor_data->next_sequence_serial;
   
-  sequence->id = NULL;
+  sequence->id = sequence->id_storage;
+  memcpy (sequence->id, id, id_len + 1);
+  sequence->id_hash = sn_string_hash (sequence->id);
+
   sequence->display = display;
   sn_display_ref (display);
 
@@ -452,61 +765,11 @@ sn_startup_sequence_new (SnDisplay *display)
   sequence->initiation_time.tv_sec = 0;
   sequence->initiation_time.tv_usec = 0;
   gettimeofday (&sequence->initiation_time, NULL);
+  sequence->initiation_msec = sn_internal_get_monotonic_msec ();
   
   return sequence;
 }
 
-typedef struct
-{
-  SnMonitorEvent *base_event;
-  SnList *events;
-} CreateContextEventsData;
-
-static sn_bool_t
-create_context_events_foreach (void *value,
-                               void *data)
-{
-  /* Make a list of events holding a ref to the context they'll go to,
-   * for reentrancy robustness
-   */
-  SnMonitorContext *context = value;
-  CreateContextEventsData *ced = data;
-
-  /* Don't send events for startup sequences initiated before the
-   * context was created
-   */
-  if (ced->base_event->sequence->creation_serial >=
-      context->creation_serial)
-    {
-      SnMonitorEvent *copy;
-      
-      copy = sn_monitor_event_copy (ced->base_event);
-      copy->context = context;
-      sn_monitor_context_ref (copy->context);
-      
-      sn_list_prepend (ced->events, copy);
-    }
-  
-  return TRUE;
-}
-
-static sn_bool_t
-dispatch_event_foreach (void *value,
-                        void *data)
-{
-  SnMonitorEvent *event = value;
-
-  /* Dispatch and free events */
-  
-  if (event->context->event_func)
-    (* event->context->event_func) (event,
-                                    event->context->event_func_data);
-
-  sn_monitor_event_unref (event);
-
-  return TRUE;
-}
-
 static sn_bool_t
 filter_event (SnMonitorEvent *event)
 {
@@ -545,193 +808,1024 @@ filter_event (SnMonitorEvent *event)
   return retval;
 }
 
-static SnStartupSequence*
-add_sequence (SnDisplay *display)
+/* Adds a live sequence whose wmclass was just set to the wmclass index */
+static void
+index_sequence_wmclass (SnStartupSequence *sequence)
 {
-  SnStartupSequence *sequence;
-  
-  sequence =
-    sn_startup_sequence_new (display);
-  
-  if (sequence)
+  SnMonitorData *monitor_data;
+  SnStartupSequence *last;
+  char buf[256];
+  char *latin1;
+  int len;
+
+  len = strlen (sequence->wmclass);
+  latin1 = len < (int) sizeof (buf) ? buf : sn_malloc (len + 1);
+
+  /* No window can have a class Latin-1 can't represent. The key
+   * isn't interned, to keep the pool statistics about attributes.
+   */
+  if (sn_internal_utf8_to_latin1 (sequence->wmclass, latin1))
     {
-      sn_startup_sequence_ref (sequence); /* ref held by sequence list */
-      if (sequence_list == NULL)
-        sequence_list = sn_list_new ();
-      sn_list_prepend (sequence_list, sequence);
+      if (strcmp (latin1, sequence->wmclass) == 0)
+        sequence->wmclass_latin1 = sequence->wmclass;
+      else if (latin1 == buf)
+        sequence->wmclass_latin1 = sn_internal_strdup (latin1);
+      else
+        sequence->wmclass_latin1 = latin1;
+      sequence->wmclass_hash = sn_string_hash (sequence->wmclass_latin1);
     }
 
-  return sequence;
-}
+  if (latin1 != buf && latin1 != sequence->wmclass_latin1)
+    sn_free (latin1);
 
-static void
-remove_sequence (SnStartupSequence *sequence)
-{
-  sn_list_remove (sequence_list, sequence);
-  sn_startup_sequence_unref (sequence);
+  if (sequence->wmclass_latin1 == NULL)
+    return;
+
+  monitor_data = sn_internal_display_get_monitor_data (sequence->display);
+
+  last = sn_hash_lookup_hashed (monitor_data->sequences_by_wmclass,
+                                sequence->wmclass_latin1,
+                                sequence->wmclass_hash);
+  if (last == NULL)
+    {
+      sn_hash_insert_hashed (monitor_data->sequences_by_wmclass,
+                             (void*) sequence->wmclass_latin1,
+                             sequence->wmclass_hash, sequence);
+      return;
+    }
+
+  while (last->wmclass_next != NULL)
+    last = last->wmclass_next;
+
+  last->wmclass_next = sequence;
+  sequence->wmclass_prev = last;
 }
 
 static void
-dispatch_monitor_event (SnDisplay      *display,
-                        SnMonitorEvent *event)
+unindex_sequence_wmclass (SnStartupSequence *sequence)
 {
-  if (event->type == SN_MONITOR_EVENT_INITIATED)
+  SnMonitorData *monitor_data;
+
+  if (sequence->wmclass_latin1 == NULL)
+    return;
+
+  monitor_data = sn_internal_display_get_monitor_data (sequence->display);
+
+  if (sequence->wmclass_prev)
     {
-      if (event->sequence == NULL)
-        event->sequence = add_sequence (display);
-    }  
-      
-  if (event->sequence != NULL &&
-      !filter_event (event))
+      sequence->wmclass_prev->wmclass_next = sequence->wmclass_next;
+    }
+  else if (sequence->wmclass_next)
     {
-      CreateContextEventsData cced;
-          
-      cced.base_event = event;
-      cced.events = sn_list_new ();
-          
-      sn_list_foreach (context_list, create_context_events_foreach,
-                       &cced);
-          
-      sn_list_foreach (cced.events, dispatch_event_foreach, NULL);
+      /* Inserting would keep the old key, which is about to go */
+      sn_hash_remove_hashed (monitor_data->sequences_by_wmclass,
+                             sequence->wmclass_latin1,
+                             sequence->wmclass_hash);
+      sn_hash_insert_hashed (monitor_data->sequences_by_wmclass,
+                             (void*) sequence->wmclass_next->wmclass_latin1,
+                             sequence->wmclass_hash, sequence->wmclass_next);
+    }
+  else
+    {
+      sn_hash_remove_hashed (monitor_data->sequences_by_wmclass,
+                             sequence->wmclass_latin1,
+                             sequence->wmclass_hash);
+    }
+  if (sequence->wmclass_next)
+    sequence->wmclass_next->wmclass_prev = sequence->wmclass_prev;
 
-      /* values in the events list freed on dispatch */
-      sn_list_free (cced.events);
+  sequence->wmclass_prev = NULL;
+  sequence->wmclass_next = NULL;
 
-      /* remove from sequence list */
-      if (event->type == SN_MONITOR_EVENT_COMPLETED)
-        remove_sequence (event->sequence);
-    }
+  if (sequence->wmclass_latin1 != sequence->wmclass)
+    sn_free ((char*) sequence->wmclass_latin1);
+  sequence->wmclass_latin1 = NULL;
 }
 
-sn_bool_t
-sn_internal_monitor_process_event (SnDisplay *display)
+static SnStartupSequence*
+find_sequence_for_wmclass (SnMonitorData *monitor_data,
+                           const char    *wmclass)
 {
-  sn_bool_t retval;
-
-  if (context_list == NULL ||
-      sn_list_empty (context_list))
-    return FALSE; /* no one cares */
+  if (wmclass == NULL)
+    return NULL;
 
-  retval = FALSE;
-  
-  return retval;
+  /* Sequences leave the index as soon as they end */
+  return sn_hash_lookup (monitor_data->sequences_by_wmclass, wmclass);
 }
 
-typedef struct
+/**
+ * sn_monitor_find_sequence_by_wmclass:
+ * @display: an #SnDisplay
+ * @res_name: resource name from the WM_CLASS of a window, or %NULL
+ * @res_class: resource class from the WM_CLASS of a window, or %NULL
+ *
+ * Finds the live startup sequence a newly mapped window with the
+ * given WM_CLASS belongs to, by comparing @res_name and @res_class,
+ * which are Latin-1 like the property itself, to the WMCLASS of each
+ * sequence. Only sequences seen by a monitor context on @display
+ * are considered. When several match, the one initiated first is
+ * returned. The window manager should then call
+ * sn_startup_sequence_complete() on it.
+ *
+ * Return value: the sequence, which is not referenced, or %NULL
+ **/
+SnStartupSequence*
+sn_monitor_find_sequence_by_wmclass (SnDisplay  *display,
+                                     const char *res_name,
+                                     const char *res_class)
 {
-  SnDisplay *display;
-  const char *id;
-  SnStartupSequence *found;
-} FindSequenceByIdData;
+  SnMonitorData *monitor_data;
+  SnStartupSequence *by_name;
+  SnStartupSequence *by_class;
 
-static sn_bool_t
-find_sequence_by_id_foreach (void *value,
-                             void *data)
+  monitor_data = sn_internal_display_get_monitor_data (display);
+
+  by_name = find_sequence_for_wmclass (monitor_data, res_name);
+  by_class = find_sequence_for_wmclass (monitor_data, res_class);
+
+  if (by_name == NULL)
+    return by_class;
+  if (by_class == NULL)
+    return by_name;
+
+  return by_name->creation_serial < by_class->creation_serial ?
+    by_name : by_class;
+}
+
+static SnStartupSequence*
+add_sequence (SnDisplay  *display,
+              const char *id)
 {
-  SnStartupSequence *sequence = value;
-  FindSequenceByIdData *fsd = data;
+  SnStartupSequence *sequence;
+  
+  sequence =
+    sn_startup_sequence_new (display, id);
   
-  if (strcmp (sequence->id, fsd->id) == 0 &&
-      sn_internal_display_get_id (sequence->display) ==
-      sn_internal_display_get_id (fsd->display))
+  if (sequence)
     {
-      fsd->found = sequence;
-      return FALSE;
+      SnMonitorData *monitor_data;
+
+      monitor_data = sn_internal_display_get_monitor_data (display);
+
+      sn_startup_sequence_ref (sequence); /* ref held by sequence index */
+      sn_hash_insert_hashed (monitor_data->sequences_by_id,
+                             sequence->id, sequence->id_hash, sequence);
+
+      sequence->older = monitor_data->newest_sequence;
+      if (sequence->older)
+        sequence->older->newer = sequence;
+      else
+        monitor_data->oldest_sequence = sequence;
+      monitor_data->newest_sequence = sequence;
     }
 
-  return TRUE;
+  return sequence;
 }
 
-static SnStartupSequence*
-find_sequence_for_id (SnDisplay      *display,
-                      const char     *id)
+static void
+remove_sequence (SnStartupSequence *sequence)
 {
-  FindSequenceByIdData fsd;
-  
-  if (sequence_list == NULL)
-    return NULL;
-  
-  fsd.display = display;
-  fsd.id = id;
-  fsd.found = NULL;
-  
-  sn_list_foreach (sequence_list, find_sequence_by_id_foreach, &fsd);
+  SnMonitorData *monitor_data;
+
+  monitor_data = sn_internal_display_get_monitor_data (sequence->display);
+
+  /* May be called again for a sequence that was canceled, by which
+   * time a newer sequence may have taken over its ID
+   */
+  if (sn_hash_lookup_hashed (monitor_data->sequences_by_id,
+                             sequence->id, sequence->id_hash) != sequence)
+    return;
+
+  sn_hash_remove_hashed (monitor_data->sequences_by_id,
+                         sequence->id, sequence->id_hash);
+
+  if (sequence->older)
+    sequence->older->newer = sequence->newer;
+  else
+    monitor_data->oldest_sequence = sequence->newer;
+  if (sequence->newer)
+    sequence->newer->older = sequence->older;
+  else
+    monitor_data->newest_sequence = sequence->older;
+  sequence->newer = NULL;
+  sequence->older = NULL;
+
+  unindex_sequence_wmclass (sequence);
 
-  return fsd.found;
+  sn_startup_sequence_unref (sequence);
 }
 
+static void dispatch_monitor_event (SnDisplay      *display,
+                                    SnMonitorEvent *event);
+static void deliver_monitor_event  (SnDisplay      *display,
+                                    SnMonitorEvent *event);
+
+/* Marks the sequence of a COMPLETED or CANCELED event as such and
+ * takes it out of the display's lists, so new messages and lookups
+ * no longer see it. Returns %FALSE if the event is a duplicate and
+ * should be dropped.
+ */
 static sn_bool_t
-do_xmessage_event_foreach (void *value,
-                           void *data)
+end_sequence (SnMonitorEvent *event)
 {
-  SnMonitorEvent *event = value;
-  SnDisplay *display = data;
-  
-  dispatch_monitor_event (display, event);
+  if (filter_event (event))
+    return FALSE;
+
+  if (event->type == SN_MONITOR_EVENT_COMPLETED ||
+      event->type == SN_MONITOR_EVENT_CANCELED)
+    remove_sequence (event->sequence); /* the event holds a ref */
 
   return TRUE;
 }
 
-static sn_bool_t
-unref_event_foreach (void *value,
-                     void *data)
+static void
+dispatch_pending_changes (SnStartupSequence *sequence)
 {
-  sn_monitor_event_unref (value);
-  return TRUE;
+  SnMonitorEvent *event;
+
+  event = monitor_event_new (SN_MONITOR_EVENT_CHANGED, sequence);
+  event->changed_fields = sequence->pending_changed_fields;
+  sequence->pending_changed_fields = 0;
+
+  dispatch_monitor_event (sequence->display, event);
+  sn_monitor_event_unref (event);
 }
 
 static void
-xmessage_func (SnDisplay  *display,
-               const char *message_type,
-               const char *message,
-               void       *user_data)
+queue_changes (SnStartupSequence *sequence,
+               unsigned int       changed_fields)
 {
-  /* assert (strcmp (message_type, KDE_STARTUP_INFO_ATOM) == 0); */
-  char *prefix;
-  char **names;
-  char **values;
-  int i;
-  const char *launch_id;
-  SnStartupSequence *sequence;
-  SnList *events;
-  
-  prefix = NULL;
-  names = NULL;
-  values = NULL;
-  if (!sn_internal_unserialize_message (message, &prefix, &names, &values))
+  SnMonitorData *monitor_data;
+
+  monitor_data = sn_internal_display_get_monitor_data (sequence->display);
+
+  sequence->pending_changed_fields |= changed_fields;
+
+  if (sequence->change_queued)
     return;
-  
-  launch_id = NULL;
-  i = 0;
-  while (names[i])
-    {
-      if (strcmp (names[i], "ID") == 0)
-        {
-          launch_id = values[i];
-          break;
-        }
-      ++i;
-    }
 
-  events = sn_list_new ();
+  sn_startup_sequence_ref (sequence);
+  sequence->change_queued = TRUE;
+  sequence->prev_changed = monitor_data->last_changed;
+  if (monitor_data->last_changed)
+    monitor_data->last_changed->next_changed = sequence;
+  else
+    monitor_data->first_changed = sequence;
+  monitor_data->last_changed = sequence;
+}
+
+/* Takes @sequence off the queue of held back changes, dropping
+ * the queue's ref
+ */
+static void
+unqueue_changes (SnStartupSequence *sequence)
+{
+  SnMonitorData *monitor_data;
+
+  if (!sequence->change_queued)
+    return;
+
+  monitor_data = sn_internal_display_get_monitor_data (sequence->display);
+
+  if (sequence->prev_changed)
+    sequence->prev_changed->next_changed = sequence->next_changed;
+  else
+    monitor_data->first_changed = sequence->next_changed;
+  if (sequence->next_changed)
+    sequence->next_changed->prev_changed = sequence->prev_changed;
+  else
+    monitor_data->last_changed = sequence->prev_changed;
+
+  sequence->next_changed = NULL;
+  sequence->prev_changed = NULL;
+  sequence->change_queued = FALSE;
+
+  sn_startup_sequence_unref (sequence);
+}
+
+static void
+dispatch_deferred_events (SnMonitorData *monitor_data)
+{
+  while (monitor_data->first_deferred != NULL)
+    {
+      SnMonitorEvent *event = monitor_data->first_deferred;
+
+      monitor_data->first_deferred = event->next;
+      if (monitor_data->first_deferred == NULL)
+        monitor_data->last_deferred = NULL;
+      event->next = NULL;
+
+      /* end_sequence() was called when the event was queued */
+      deliver_monitor_event (event->sequence->display, event);
+      sn_monitor_event_unref (event);
+    }
+}
+
+/* Dispatches @event now, or queues it for sn_display_dispatch_pending() */
+static void
+emit_monitor_event (SnDisplay      *display,
+                    SnMonitorEvent *event)
+{
+  SnMonitorData *monitor_data;
+
+  monitor_data = sn_internal_display_get_monitor_data (display);
+
+  if (!monitor_data->defer_dispatch)
+    {
+      dispatch_monitor_event (display, event);
+      return;
+    }
+
+  /* Only the callbacks wait; the sequence ends right away */
+  if (!end_sequence (event))
+    return;
+
+  sn_monitor_event_ref (event);
+  if (monitor_data->last_deferred)
+    monitor_data->last_deferred->next = event;
+  else
+    monitor_data->first_deferred = event;
+  monitor_data->last_deferred = event;
+}
+
+void
+sn_internal_monitor_flush_changes (SnDisplay *display)
+{
+  SnMonitorData *monitor_data;
+
+  monitor_data = sn_internal_display_get_monitor_data (display);
+
+  /* Deferred events are older than any held back change */
+  dispatch_deferred_events (monitor_data);
+
+  /* Callbacks may queue more changes, which are sent too */
+  while (monitor_data->first_changed != NULL)
+    {
+      SnStartupSequence *sequence = monitor_data->first_changed;
+
+      sn_startup_sequence_ref (sequence);
+      unqueue_changes (sequence);
+      dispatch_pending_changes (sequence);
+      sn_startup_sequence_unref (sequence);
+    }
+}
+
+void
+sn_internal_monitor_set_defer_dispatch (SnDisplay *display,
+                                        sn_bool_t  defer)
+{
+  sn_internal_display_get_monitor_data (display)->defer_dispatch = defer;
+
+  if (!defer)
+    sn_internal_monitor_dispatch_pending (display);
+}
+
+void
+sn_internal_monitor_dispatch_pending (SnDisplay *display)
+{
+  /* Sends the deferred events, then the held back changes */
+  sn_internal_monitor_flush_changes (display);
+}
+
+sn_bool_t
+sn_internal_monitor_has_pending (SnDisplay *display)
+{
+  SnMonitorData *monitor_data;
+
+  monitor_data = sn_internal_display_get_monitor_data (display);
+
+  return (monitor_data->first_deferred != NULL ||
+          monitor_data->first_changed != NULL);
+}
+
+void
+sn_internal_monitor_set_coalesce_changes (SnDisplay *display,
+                                          sn_bool_t  coalesce)
+{
+  sn_internal_display_get_monitor_data (display)->coalesce_changes = coalesce;
+
+  if (!coalesce)
+    sn_internal_monitor_flush_changes (display);
+}
+
+static void
+dispatch_monitor_event (SnDisplay      *display,
+                        SnMonitorEvent *event)
+{
+  if (event->sequence != NULL &&
+      end_sequence (event))
+    deliver_monitor_event (display, event);
+}
+
+/* Calls each context back with @event, once end_sequence() let it
+ * through
+ */
+static void
+deliver_monitor_event (SnDisplay      *display,
+                       SnMonitorEvent *event)
+{
+  SnMonitorContext *context;
+  SnMonitorEvent *context_event;
+
+  /* Changes held back for the sequence go out before it ends,
+   * so clients still see its events in order
+   */
+  if ((event->type == SN_MONITOR_EVENT_COMPLETED ||
+       event->type == SN_MONITOR_EVENT_CANCELED) &&
+      event->sequence->change_queued)
+    {
+      SnStartupSequence *sequence = event->sequence;
+
+      unqueue_changes (sequence); /* the event holds a ref */
+      dispatch_pending_changes (sequence);
+    }
+
+  /* One event is passed to each context in turn, unless a
+   * callback keeps a ref to it. We hold a ref on the context
+   * being called so that callbacks may unref contexts.
+   */
+  context_event = NULL;
+
+  context = sn_internal_display_get_monitor_data (display)->contexts;
+  if (context)
+    sn_monitor_context_ref (context);
+
+  while (context != NULL)
+    {
+      SnMonitorContext *next;
+
+      /* Don't send events for startup sequences initiated before the
+       * context was created
+       */
+      if (event->sequence->creation_serial >= context->creation_serial &&
+          context->event_func)
+        {
+          if (context_event == NULL)
+            {
+              context_event = monitor_event_new (event->type,
+                                                 event->sequence);
+              context_event->changed_fields = event->changed_fields;
+            }
+          else
+            sn_monitor_context_unref (context_event->context);
+
+          context_event->context = context;
+          sn_monitor_context_ref (context);
+
+          (* context->event_func) (context_event,
+                                   context->event_func_data);
+
+          if (context_event->refcount > 1)
+            {
+              sn_monitor_event_unref (context_event);
+              context_event = NULL;
+            }
+        }
+
+      next = context->next;
+      if (next)
+        sn_monitor_context_ref (next);
+      sn_monitor_context_unref (context);
+      context = next;
+    }
+
+  if (context_event)
+    sn_monitor_event_unref (context_event);
+}
+
+sn_bool_t
+sn_internal_monitor_process_event (SnDisplay *display)
+{
+  sn_bool_t retval;
+
+  if (sn_internal_display_get_monitor_data (display)->contexts == NULL)
+    return FALSE; /* no one cares */
+
+  retval = FALSE;
+  
+  return retval;
+}
+
+/* Milliseconds from @now until @sequence times out, 0 if it has */
+static int
+get_sequence_remaining (SnMonitorData     *monitor_data,
+                        SnStartupSequence *sequence,
+                        unsigned long      now)
+{
+  unsigned long elapsed;
+
+  elapsed = now - sequence->initiation_msec;
+  if (elapsed >= (unsigned long) monitor_data->sequence_timeout)
+    return 0;
+
+  return monitor_data->sequence_timeout - (int) elapsed;
+}
+
+void
+sn_internal_monitor_set_sequence_timeout (SnDisplay *display,
+                                          int        timeout)
+{
+  sn_internal_display_get_monitor_data (display)->sequence_timeout = timeout;
+}
+
+int
+sn_internal_monitor_get_next_timeout (SnDisplay *display)
+{
+  SnMonitorData *monitor_data;
+  sn_bool_t sequence_pending;
+  sn_bool_t early_change_pending;
+  unsigned long now;
+  int timeout;
+  int early_change_timeout;
+
+  monitor_data = sn_internal_display_get_monitor_data (display);
+
+  sequence_pending = (monitor_data->oldest_sequence != NULL &&
+                      monitor_data->sequence_timeout > 0);
+  early_change_pending = (monitor_data->oldest_early_change != NULL &&
+                          monitor_data->early_change_timeout > 0);
+
+  if (!sequence_pending && !early_change_pending)
+    return -1;
+
+  now = sn_internal_get_monotonic_msec ();
+
+  timeout = -1;
+  if (sequence_pending)
+    timeout = get_sequence_remaining (monitor_data,
+                                      monitor_data->oldest_sequence, now);
+
+  if (early_change_pending)
+    {
+      early_change_timeout =
+        get_early_change_remaining (monitor_data,
+                                    monitor_data->oldest_early_change, now);
+      if (timeout < 0 || early_change_timeout < timeout)
+        timeout = early_change_timeout;
+    }
+
+  return timeout;
+}
+
+void
+sn_internal_monitor_dispatch_timeouts (SnDisplay *display)
+{
+  SnMonitorData *monitor_data;
+  unsigned long now;
+
+  monitor_data = sn_internal_display_get_monitor_data (display);
+
+  /* Cancel sequences only after the events that came before */
+  if (monitor_data->sequence_timeout > 0)
+    dispatch_deferred_events (monitor_data);
+
+  now = sn_internal_get_monotonic_msec ();
+
+  evict_early_changes (monitor_data, now);
+
+  if (monitor_data->sequence_timeout <= 0)
+    return;
+
+  while (monitor_data->oldest_sequence != NULL)
+    {
+      SnStartupSequence *sequence = monitor_data->oldest_sequence;
+      SnMonitorEvent *event;
+
+      if (get_sequence_remaining (monitor_data, sequence, now) > 0)
+        break;
+
+      /* Dispatching removes the sequence from the list */
+      event = monitor_event_new (SN_MONITOR_EVENT_CANCELED, sequence);
+      dispatch_monitor_event (display, event);
+      sn_monitor_event_unref (event);
+    }
+}
+
+static SnStartupSequence*
+find_sequence_for_id (SnDisplay      *display,
+                      const char     *id)
+{
+  return sn_hash_lookup (sn_internal_display_get_monitor_data (display)->sequences_by_id,
+                         id);
+}
+
+/**
+ * sn_monitor_find_sequences_for_windows:
+ * @display: an #SnDisplay
+ * @xwindows: windows to look up
+ * @n_windows: number of windows
+ * @sequences: array of @n_windows to return the sequences in
+ *
+ * Finds the live startup sequence each window belongs to, from the
+ * _NET_STARTUP_ID of the window or of its WM_CLIENT_LEADER, as a
+ * window manager does for the existing windows when it starts. The
+ * properties of all windows are read together, so this costs two
+ * round trips to the X server however many windows there are. Only
+ * sequences seen by a monitor context on @display are found.
+ *
+ * The sequences returned are not referenced; windows without a live
+ * sequence get %NULL.
+ **/
+void
+sn_monitor_find_sequences_for_windows (SnDisplay          *display,
+                                       const xcb_window_t *xwindows,
+                                       int                 n_windows,
+                                       SnStartupSequence **sequences)
+{
+  char **startup_ids;
+  int i;
+
+  if (n_windows <= 0)
+    return;
+
+  startup_ids = sn_new (char*, n_windows);
+
+  sn_internal_get_startup_ids (display, xwindows, n_windows, startup_ids);
+
+  for (i = 0; i < n_windows; ++i)
+    {
+      if (startup_ids[i] != NULL)
+        {
+          sequences[i] = find_sequence_for_id (display, startup_ids[i]);
+          sn_free (startup_ids[i]);
+        }
+      else
+        sequences[i] = NULL;
+    }
+
+  sn_free (startup_ids);
+}
+
+void
+sn_internal_monitor_set_early_change_limits (SnDisplay *display,
+                                             int        max_bytes,
+                                             int        max_age)
+{
+  SnMonitorData *monitor_data;
+
+  monitor_data = sn_internal_display_get_monitor_data (display);
+
+  monitor_data->max_early_change_bytes = max_bytes;
+  monitor_data->early_change_timeout = max_age;
+}
+
+static void
+early_change_free (SnEarlyChange *early_change)
+{
+  int i;
+
+  for (i = 0; i < early_change->n_messages; ++i)
+    sn_free (early_change->messages[i]);
+  sn_free (early_change->messages);
+  sn_free (early_change->id);
+  sn_free (early_change);
+}
+
+static void
+remove_early_change (SnMonitorData *monitor_data,
+                     SnEarlyChange *early_change)
+{
+  sn_hash_remove_hashed (monitor_data->early_changes,
+                         early_change->id, early_change->id_hash);
+
+  if (early_change->older)
+    early_change->older->newer = early_change->newer;
+  else
+    monitor_data->oldest_early_change = early_change->newer;
+  if (early_change->newer)
+    early_change->newer->older = early_change->older;
+  else
+    monitor_data->newest_early_change = early_change->older;
+
+  monitor_data->early_change_bytes -= early_change->size;
+}
+
+/* Milliseconds from @now until @early_change expires, 0 if it has */
+static int
+get_early_change_remaining (SnMonitorData *monitor_data,
+                            SnEarlyChange *early_change,
+                            unsigned long  now)
+{
+  unsigned long elapsed;
+
+  elapsed = now - early_change->received;
+  if (elapsed >= (unsigned long) monitor_data->early_change_timeout)
+    return 0;
+
+  return monitor_data->early_change_timeout - (int) elapsed;
+}
+
+/* Drop the oldest early changes while they take up too much memory,
+ * or were received too long ago
+ */
+static void
+evict_early_changes (SnMonitorData *monitor_data,
+                     unsigned long  now)
+{
+  while (monitor_data->oldest_early_change != NULL)
+    {
+      SnEarlyChange *oldest = monitor_data->oldest_early_change;
+
+      if (!(monitor_data->max_early_change_bytes > 0 &&
+            monitor_data->early_change_bytes >
+            monitor_data->max_early_change_bytes) &&
+          !(monitor_data->early_change_timeout > 0 &&
+            get_early_change_remaining (monitor_data, oldest, now) == 0))
+        break;
+
+      remove_early_change (monitor_data, oldest);
+      early_change_free (oldest);
+    }
+}
+
+/* The #SnStartupSequenceField bits of the fields @sequence has */
+static unsigned int
+get_set_fields (SnStartupSequence *sequence)
+{
+  unsigned int fields;
+
+  fields = 0;
+  if (sequence->name)
+    fields |= SN_STARTUP_SEQUENCE_FIELD_NAME;
+  if (sequence->description)
+    fields |= SN_STARTUP_SEQUENCE_FIELD_DESCRIPTION;
+  if (sequence->wmclass)
+    fields |= SN_STARTUP_SEQUENCE_FIELD_WMCLASS;
+  if (sequence->workspace >= 0)
+    fields |= SN_STARTUP_SEQUENCE_FIELD_WORKSPACE;
+  if (sequence->timestamp_set)
+    fields |= SN_STARTUP_SEQUENCE_FIELD_TIMESTAMP;
+  if (sequence->binary_name)
+    fields |= SN_STARTUP_SEQUENCE_FIELD_BINARY_NAME;
+  if (sequence->icon_name)
+    fields |= SN_STARTUP_SEQUENCE_FIELD_ICON_NAME;
+  if (sequence->application_id)
+    fields |= SN_STARTUP_SEQUENCE_FIELD_APPLICATION_ID;
+  if (sequence->screen >= 0)
+    fields |= SN_STARTUP_SEQUENCE_FIELD_SCREEN;
+
+  return fields;
+}
+
+/* Fills in the fields of @sequence that @parsed sets, returning
+ * the #SnStartupSequenceField bits of those that changed
+ */
+static unsigned int
+apply_properties (SnStartupSequence     *sequence,
+                  const SnParsedMessage *parsed)
+{
+  unsigned int changed;
+  int i;
+
+  changed = 0;
+
+  i = 0;
+  while (i < parsed->n_properties)
+    {
+      const char *value = parsed->properties[i].value;
+
+      switch (sn_internal_lookup_key (parsed->properties[i].name,
+                                      parsed->properties[i].name_len))
+        {
+        case SN_KEY_BIN:
+          if (sequence->binary_name == NULL)
+            {
+              sequence->binary_name =
+                sn_internal_display_intern_string (sequence->display, value);
+              changed |= SN_STARTUP_SEQUENCE_FIELD_BINARY_NAME;
+            }              
+          break;
+        case SN_KEY_NAME:
+          if (sequence->name == NULL)
+            {
+              sequence->name =
+                sn_internal_display_intern_string (sequence->display, value);
+              changed |= SN_STARTUP_SEQUENCE_FIELD_NAME;
+            }
+          break;
+        case SN_KEY_SCREEN:
+          if (sequence->screen < 0)
+            {
+              int n;
+              n = atoi (value);
+              if (n >= 0 && n < sn_internal_display_get_screen_number (sequence->display))
+                {
+                  sequence->screen = n;
+                  changed |= SN_STARTUP_SEQUENCE_FIELD_SCREEN;
+                }
+            }
+          break;
+        case SN_KEY_DESCRIPTION:
+          if (sequence->description == NULL)
+            {
+              sequence->description = sn_internal_strdup (value);
+              changed |= SN_STARTUP_SEQUENCE_FIELD_DESCRIPTION;
+            }
+          break;
+        case SN_KEY_ICON:
+          if (sequence->icon_name == NULL)
+            {
+              sequence->icon_name =
+                sn_internal_display_intern_string (sequence->display, value);
+              changed |= SN_STARTUP_SEQUENCE_FIELD_ICON_NAME;
+            }
+          break;
+        case SN_KEY_APPLICATION_ID:
+          if (sequence->application_id == NULL)
+            {
+              sequence->application_id =
+                sn_internal_display_intern_string (sequence->display, value);
+              changed |= SN_STARTUP_SEQUENCE_FIELD_APPLICATION_ID;
+            }
+          break;
+        case SN_KEY_DESKTOP:
+          {
+            int workspace;
+
+            workspace = sn_internal_string_to_ulong (value);
+
+            if (sequence->workspace != workspace)
+              {
+                sequence->workspace = workspace;
+                changed |= SN_STARTUP_SEQUENCE_FIELD_WORKSPACE;
+              }
+          }
+          break;
+        case SN_KEY_TIMESTAMP:
+          if (!sequence->timestamp_set)
+            {
+              /* Old version of the spec says that the timestamp was
+               * sent as part of a TIMESTAMP message.  We try to
+               * handle that to enable backwards compatibility with
+               * older launchers.
+               */
+              Time timestamp;
+
+              timestamp = sn_internal_string_to_ulong (value);
+
+              sequence->timestamp = timestamp;
+              sequence->timestamp_set = TRUE;
+              changed |= SN_STARTUP_SEQUENCE_FIELD_TIMESTAMP;
+            }
+          break;
+        case SN_KEY_WMCLASS:
+          if (sequence->wmclass == NULL)
+            {
+              sequence->wmclass =
+                sn_internal_display_intern_string (sequence->display, value);
+              index_sequence_wmclass (sequence);
+              changed |= SN_STARTUP_SEQUENCE_FIELD_WMCLASS;
+            }
+          break;
+        default:
+          /* ID, and keys we don't know about */
+          break;
+        }
+      
+      ++i;
+    }
+
+  if (changed)
+    sequence->generation += 1;
+
+  return changed;
+}
+
+/* Remember a "change:" message for a startup ID that has no
+ * sequence yet, to be applied when its "new:" arrives
+ */
+static void
+add_early_change (SnDisplay  *display,
+                  const char *id,
+                  const char *message)
+{
+  SnMonitorData *monitor_data;
+  SnEarlyChange *early_change;
+  unsigned int id_hash;
+  int size;
+
+  monitor_data = sn_internal_display_get_monitor_data (display);
+
+  size = strlen (message) + 1 + sizeof (char*);
+
+  id_hash = sn_string_hash (id);
+  early_change = sn_hash_lookup_hashed (monitor_data->early_changes,
+                                        id, id_hash);
+  if (early_change == NULL)
+    {
+      size += sizeof (SnEarlyChange) + strlen (id) + 1;
+
+      early_change = sn_new0 (SnEarlyChange, 1);
+      early_change->id = sn_internal_strdup (id);
+      early_change->id_hash = id_hash;
+      early_change->received = sn_internal_get_monotonic_msec ();
+
+      sn_hash_insert_hashed (monitor_data->early_changes,
+                             early_change->id, id_hash, early_change);
+
+      early_change->older = monitor_data->newest_early_change;
+      if (early_change->older)
+        early_change->older->newer = early_change;
+      else
+        monitor_data->oldest_early_change = early_change;
+      monitor_data->newest_early_change = early_change;
+    }
+
+  early_change->messages = sn_renew (char*, early_change->messages,
+                                     early_change->n_messages + 1);
+  early_change->messages[early_change->n_messages] =
+    sn_internal_strdup (message);
+  early_change->n_messages += 1;
+  early_change->size += size;
+  monitor_data->early_change_bytes += size;
+
+  evict_early_changes (monitor_data, sn_internal_get_monotonic_msec ());
+}
+
+/* Take the early changes for a startup ID, if there are any that
+ * haven't expired; the caller frees the result
+ */
+static SnEarlyChange*
+take_early_change (SnDisplay  *display,
+                   const char *id)
+{
+  SnMonitorData *monitor_data;
+  SnEarlyChange *early_change;
+
+  monitor_data = sn_internal_display_get_monitor_data (display);
+
+  if (monitor_data->oldest_early_change == NULL)
+    return NULL;
+
+  early_change = sn_hash_lookup (monitor_data->early_changes, id);
+  if (early_change == NULL)
+    return NULL;
+
+  remove_early_change (monitor_data, early_change);
+
+  if (monitor_data->early_change_timeout > 0 &&
+      get_early_change_remaining (monitor_data, early_change,
+                                  sn_internal_get_monotonic_msec ()) == 0)
+    {
+      early_change_free (early_change);
+      return NULL;
+    }
+
+  return early_change;
+}
+
+static void
+xmessage_func (SnDisplay  *display,
+               const char *message_type,
+               const char *message,
+               int         message_len,
+               void       *user_data)
+{
+  /* assert (strcmp (message_type, KDE_STARTUP_INFO_ATOM) == 0); */
+  SnParsedMessage parsed;
+  SnMessageType type;
+  int i;
+  const char *launch_id;
+  SnStartupSequence *sequence;
+  /* a message causes at most two events */
+  SnMonitorEvent *events[2];
+  int n_events;
+  
+  if (!sn_internal_parse_message (message, message_len, &parsed))
+    return;
+
+  type = sn_internal_lookup_message_type (parsed.prefix, parsed.prefix_len);
+  
+  launch_id = NULL;
+  i = 0;
+  while (i < parsed.n_properties)
+    {
+      if (sn_internal_lookup_key (parsed.properties[i].name,
+                                  parsed.properties[i].name_len) == SN_KEY_ID)
+        {
+          launch_id = parsed.properties[i].value;
+          break;
+        }
+      ++i;
+    }
+
+  n_events = 0;
   
   if (launch_id == NULL)
     goto out;
   
   sequence = find_sequence_for_id (display, launch_id);
 
-  if (strcmp (prefix, "new") == 0)
+  if (type == SN_MESSAGE_NEW)
     {
       if (sequence == NULL)
         {
           SnMonitorEvent *event;
           char *time_str;
 
-          sequence = add_sequence (display);
+          sequence = add_sequence (display, launch_id);
           if (sequence == NULL)
             goto out;
-          
-          sequence->id = sn_internal_strdup (launch_id);
 
           /* Current spec says timestamp is part of the startup id; so we need
            * to get the timestamp here if the launcher is using the current spec
@@ -746,133 +1840,70 @@ xmessage_func (SnDisplay  *display,
               sequence->timestamp_set = TRUE;
             }
           
-          event = sn_new (SnMonitorEvent, 1);
-          
-          event->refcount = 1;
-          event->type = SN_MONITOR_EVENT_INITIATED;
-          event->context = NULL;
-          event->sequence = sequence; /* ref from add_sequence goes here */
+          event = monitor_event_new (SN_MONITOR_EVENT_INITIATED, sequence);
+          sn_startup_sequence_unref (sequence); /* ref from add_sequence */
           
-          sn_list_append (events, event);
+          events[n_events++] = event;
         }
     }
 
   if (sequence == NULL)
-    goto out;
+    {
+      if (type == SN_MESSAGE_CHANGE)
+        {
+          add_early_change (display, launch_id, message);
+        }
+      else if (type == SN_MESSAGE_REMOVE)
+        {
+          SnEarlyChange *early_change;
+
+          /* Ended before it started; forget what we were told early */
+          early_change = take_early_change (display, launch_id);
+          if (early_change)
+            early_change_free (early_change);
+        }
+      goto out;
+    }
   
-  if (strcmp (prefix, "change") == 0 ||
-      strcmp (prefix, "new") == 0)
+  if (type == SN_MESSAGE_CHANGE ||
+      type == SN_MESSAGE_NEW)
     {
-      sn_bool_t changed = FALSE;
+      unsigned int changed;
+
+      changed = apply_properties (sequence, &parsed);
 
-      i = 0;
-      while (names[i])
+      if (type == SN_MESSAGE_NEW)
         {
-          if (strcmp (names[i], "BIN") == 0)
-            {
-              if (sequence->binary_name == NULL)
-                {
-                  sequence->binary_name = sn_internal_strdup (values[i]);
-                  changed = TRUE;
-                }              
-            }
-          else if (strcmp (names[i], "NAME") == 0)
-            {
-              if (sequence->name == NULL)
-                {
-                  sequence->name = sn_internal_strdup (values[i]);
-                  changed = TRUE;
-                }
-            }
-          else if (strcmp (names[i], "SCREEN") == 0)
+          SnEarlyChange *early_change;
+
+          early_change = take_early_change (display, launch_id);
+          if (early_change)
             {
-              if (sequence->screen < 0)
+              for (i = 0; i < early_change->n_messages; ++i)
                 {
-                  int n;
-                  n = atoi (values[i]);
-                  if (n >= 0 && n < sn_internal_display_get_screen_number (sequence->display))
+                  SnParsedMessage early;
+
+                  if (sn_internal_parse_message (early_change->messages[i],
+                                                 -1, &early))
                     {
-                      sequence->screen = n;
-                      changed = TRUE;
+                      apply_properties (sequence, &early);
+                      sn_internal_parsed_message_free (&early);
                     }
                 }
-            }
-          else if (strcmp (names[i], "DESCRIPTION") == 0)
-            {
-              if (sequence->description == NULL)
-                {
-                  sequence->description = sn_internal_strdup (values[i]);
-                  changed = TRUE;
-                }
-            }          
-          else if (strcmp (names[i], "ICON") == 0)
-            {
-              if (sequence->icon_name == NULL)
-                {
-                  sequence->icon_name = sn_internal_strdup (values[i]);
-                  changed = TRUE;
-                }
-            }
-          else if (strcmp (names[i], "APPLICATION_ID") == 0)
-            {
-              if (sequence->application_id == NULL)
-                {
-                  sequence->application_id = sn_internal_strdup (values[i]);
-                  changed = TRUE;
-                }
-            }
-          else if (strcmp (names[i], "DESKTOP") == 0)
-            {
-              int workspace;
 
-              workspace = sn_internal_string_to_ulong (values[i]);
-
-              sequence->workspace = workspace;
-              changed = TRUE;
+              early_change_free (early_change);
             }
-          else if (strcmp (names[i], "TIMESTAMP") == 0 && 
-                   !sequence->timestamp_set)
-            {
-              /* Old version of the spec says that the timestamp was
-               * sent as part of a TIMESTAMP message.  We try to
-               * handle that to enable backwards compatibility with
-               * older launchers.
-               */
-              Time timestamp;
-
-              timestamp = sn_internal_string_to_ulong (values[i]);
 
-              sequence->timestamp = timestamp;
-              sequence->timestamp_set = TRUE;
-              changed = TRUE;
-            }
-          else if (strcmp (names[i], "WMCLASS") == 0)
-            {
-              if (sequence->wmclass == NULL)
-                {
-                  sequence->wmclass = sn_internal_strdup (values[i]);
-                  changed = TRUE;
-                }
-            }
-          
-          ++i;
-        }
+          if (n_events > 0 && events[0]->type == SN_MONITOR_EVENT_INITIATED)
+            events[0]->changed_fields = get_set_fields (sequence);
 
-      if (strcmp (prefix, "new") == 0)
-        {
           if (sequence->screen < 0)
             {
               SnMonitorEvent *event;
               
-              event = sn_new (SnMonitorEvent, 1);
-              
-              event->refcount = 1;
-              event->type = SN_MONITOR_EVENT_COMPLETED;
-              event->context = NULL;
-              event->sequence = sequence;
-              sn_startup_sequence_ref (sequence);
+              event = monitor_event_new (SN_MONITOR_EVENT_COMPLETED, sequence);
               
-              sn_list_append (events, event);
+              events[n_events++] = event;
 
               fprintf (stderr,
                        "Ending startup notification for %s (%s) because SCREEN "
@@ -882,48 +1913,36 @@ xmessage_func (SnDisplay  *display,
                        sequence->binary_name ? sequence->binary_name : "???");
             }
         }
+      else if (changed &&
+               sn_internal_display_get_monitor_data (display)->coalesce_changes)
+        {
+          queue_changes (sequence, changed);
+        }
       else if (changed)
         {
           SnMonitorEvent *event;
           
-          event = sn_new (SnMonitorEvent, 1);
-          
-          event->refcount = 1;
-          event->type = SN_MONITOR_EVENT_CHANGED;
-          event->context = NULL;
-          event->sequence = sequence;
-          sn_startup_sequence_ref (sequence);
+          event = monitor_event_new (SN_MONITOR_EVENT_CHANGED, sequence);
+          event->changed_fields = changed;
           
-          sn_list_append (events, event);
+          events[n_events++] = event;
         }
     }
-  else if (strcmp (prefix, "remove") == 0)
+  else if (type == SN_MESSAGE_REMOVE)
     {
       SnMonitorEvent *event;
       
-      event = sn_new (SnMonitorEvent, 1);
-      
-      event->refcount = 1;
-      event->type = SN_MONITOR_EVENT_COMPLETED;
-      event->context = NULL;
-      event->sequence = sequence;
-      sn_startup_sequence_ref (sequence);
+      event = monitor_event_new (SN_MONITOR_EVENT_COMPLETED, sequence);
       
-      sn_list_append (events, event);
+      events[n_events++] = event;
     }
 
-  sn_list_foreach (events,
-                   do_xmessage_event_foreach,
-                   display); 
+  for (i = 0; i < n_events; ++i)
+    emit_monitor_event (display, events[i]);
   
  out:
-  if (events != NULL)
-    {
-      sn_list_foreach (events, unref_event_foreach, NULL);
-      sn_list_free (events);
-    }
+  for (i = 0; i < n_events; ++i)
+    sn_monitor_event_unref (events[i]);
   
-  sn_free (prefix);
-  sn_internal_strfreev (names);
-  sn_internal_strfreev (values);
+  sn_internal_parsed_message_free (&parsed);
 }
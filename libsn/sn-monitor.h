@@ -38,15 +38,30 @@ typedef struct SnStartupSequence SnStartupSequence;
 
 typedef void (* SnMonitorEventFunc) (SnMonitorEvent *event,
                                      void           *user_data);
+typedef sn_bool_t (* SnStartupSequenceForeachFunc) (SnStartupSequence *sequence,
+                                                    void              *data);
 
 typedef enum
 {
   SN_MONITOR_EVENT_INITIATED,
   SN_MONITOR_EVENT_COMPLETED,
   SN_MONITOR_EVENT_CHANGED,
-  SN_MONITOR_EVENT_CANCELED /* not used for now */
+  SN_MONITOR_EVENT_CANCELED /* timed out, see sn_display_dispatch_timeouts() */
 } SnMonitorEventType;
 
+typedef enum
+{
+  SN_STARTUP_SEQUENCE_FIELD_NAME           = 1 << 0,
+  SN_STARTUP_SEQUENCE_FIELD_DESCRIPTION    = 1 << 1,
+  SN_STARTUP_SEQUENCE_FIELD_WMCLASS        = 1 << 2,
+  SN_STARTUP_SEQUENCE_FIELD_WORKSPACE      = 1 << 3,
+  SN_STARTUP_SEQUENCE_FIELD_TIMESTAMP      = 1 << 4,
+  SN_STARTUP_SEQUENCE_FIELD_BINARY_NAME    = 1 << 5,
+  SN_STARTUP_SEQUENCE_FIELD_ICON_NAME      = 1 << 6,
+  SN_STARTUP_SEQUENCE_FIELD_APPLICATION_ID = 1 << 7,
+  SN_STARTUP_SEQUENCE_FIELD_SCREEN         = 1 << 8
+} SnStartupSequenceField;
+
 SnMonitorContext*  sn_monitor_context_new                  (SnDisplay           *display,
                                                             int                  screen,
                                                             SnMonitorEventFunc   event_func,
@@ -54,6 +69,16 @@ SnMonitorContext*  sn_monitor_context_new                  (SnDisplay
                                                             SnFreeFunc           free_data_func);
 void               sn_monitor_context_ref                  (SnMonitorContext *context);
 void               sn_monitor_context_unref                (SnMonitorContext *context);
+void               sn_monitor_context_foreach_sequence     (SnMonitorContext             *context,
+                                                            SnStartupSequenceForeachFunc  func,
+                                                            void                         *data);
+SnStartupSequence* sn_monitor_find_sequence_by_wmclass     (SnDisplay                    *display,
+                                                            const char                   *res_name,
+                                                            const char                   *res_class);
+void               sn_monitor_find_sequences_for_windows   (SnDisplay                    *display,
+                                                            const xcb_window_t           *xwindows,
+                                                            int                           n_windows,
+                                                            SnStartupSequence           **sequences);
 
 void               sn_monitor_event_ref                  (SnMonitorEvent *event);
 void               sn_monitor_event_unref                (SnMonitorEvent *event);
@@ -61,6 +86,7 @@ SnMonitorEvent*    sn_monitor_event_copy                 (SnMonitorEvent *event)
 SnMonitorEventType sn_monitor_event_get_type             (SnMonitorEvent *event);
 SnStartupSequence* sn_monitor_event_get_startup_sequence (SnMonitorEvent *event);
 SnMonitorContext*  sn_monitor_event_get_context          (SnMonitorEvent *event);
+unsigned int       sn_monitor_event_get_changed_fields   (SnMonitorEvent *event);
 
 
 void        sn_startup_sequence_ref                       (SnStartupSequence *sequence);
@@ -76,6 +102,7 @@ const char* sn_startup_sequence_get_binary_name           (SnStartupSequence *se
 const char* sn_startup_sequence_get_icon_name             (SnStartupSequence *sequence);
 const char* sn_startup_sequence_get_application_id        (SnStartupSequence *sequence);
 int         sn_startup_sequence_get_screen                (SnStartupSequence *sequence);
+unsigned int sn_startup_sequence_get_generation           (SnStartupSequence *sequence);
 
 void        sn_startup_sequence_get_initiated_time        (SnStartupSequence *sequence,
                                                            time_t            *tv_sec,
@@ -26,6 +26,8 @@
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
+#include <time.h>
+#include <sys/time.h>
 
 #ifndef	REALLOC_0_WORKS
 static void*
@@ -251,6 +253,42 @@ sn_internal_utf8_validate (const char *str,
     return TRUE;
 }
 
+/**
+ * sn_internal_utf8_to_latin1:
+ * @str: a UTF-8 string
+ * @latin1: buffer of at least strlen (@str) + 1 bytes
+ *
+ * Converts @str to Latin-1, the encoding of WM_CLASS hints.
+ *
+ * Return value: %FALSE if @str has characters Latin-1 can't represent
+ **/
+sn_bool_t
+sn_internal_utf8_to_latin1 (const char *str,
+                            char       *latin1)
+{
+  const unsigned char *p;
+
+  p = (const unsigned char*) str;
+  while (*p)
+    {
+      if (*p < 0x80)
+        {
+          *latin1++ = *p++;
+        }
+      else if ((*p == 0xC2 || *p == 0xC3) &&
+               (p[1] & 0xC0) == 0x80)
+        {
+          *latin1++ = ((p[0] & 0x1F) << 6) | (p[1] & 0x3F);
+          p += 2;
+        }
+      else
+        return FALSE;
+    }
+  *latin1 = '\0';
+
+  return TRUE;
+}
+
 char*
 sn_internal_strdup (const char *str)
 {
@@ -310,6 +348,34 @@ sn_internal_string_to_ulong (const char* str)
   return retval;
 }
 
+/**
+ * sn_internal_get_monotonic_msec:
+ *
+ * Reads a clock in milliseconds that changes to the system time
+ * don't affect, falling back to gettimeofday() where there is no
+ * such clock. Only the difference between two readings means
+ * anything; computed in unsigned arithmetic, it survives the value
+ * wrapping around.
+ *
+ * Return value: the time in milliseconds
+ **/
+unsigned long
+sn_internal_get_monotonic_msec (void)
+{
+  struct timeval tv;
+
+#if defined (HAVE_CLOCK_GETTIME) && defined (CLOCK_MONOTONIC)
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_MONOTONIC, &ts) == 0)
+    return (unsigned long) ts.tv_sec * 1000UL + ts.tv_nsec / 1000000L;
+#endif
+
+  gettimeofday (&tv, NULL);
+
+  return (unsigned long) tv.tv_sec * 1000UL + tv.tv_usec / 1000L;
+}
+
 /**
  * sn_internal_find_last_occurrence:
  * @haystack: a nul-terminated string.
@@ -29,10 +29,17 @@
 #include "sn-list.h"
 #include "sn-internals.h"
 
+#include <xcb/xcb_event.h>
+
 typedef struct
 {
-  void          *xid;
   xcb_window_t   root;
+  /* The atoms are resolved and the handler added to
+   * handlers_by_atom when the next event arrives
+   */
+  SnLazyAtom    *lazy_type_atom;
+  SnLazyAtom    *lazy_type_atom_begin;
+  sn_bool_t      indexed;
   xcb_atom_t     type_atom;
   xcb_atom_t     type_atom_begin;
   char          *message_type;
@@ -41,13 +48,313 @@ typedef struct
   SnFreeFunc     free_data_func;
 } SnXmessageHandler;
 
-typedef struct
+typedef struct SnXmessage SnXmessage;
+
+struct SnXmessage
 {
   xcb_atom_t type_atom_begin;
   xcb_window_t xwindow;
   char *message;
+  /* bytes received so far, not counting a final nul */
+  int length;
   int allocated;
-} SnXmessage;
+  /* sn_internal_get_monotonic_msec() when the first chunk arrived,
+   * and links in the list of pending messages in order of arrival
+   */
+  unsigned long started;
+  SnXmessage *newer;
+  SnXmessage *older;
+};
+
+/* Most messages fit in the first buffer; longer ones double it */
+#define INITIAL_MESSAGE_ALLOCATION 256
+
+/* We don't want screwy situations to end up causing us to allocate
+ * infinite memory. Cap the length of a message.
+ */
+#define MAX_MESSAGE_LENGTH 4096
+
+/* Defaults for the bounds on partially received messages; a
+ * sender dying mid-message would otherwise leak it forever.
+ */
+#define DEFAULT_MAX_PENDING_MESSAGES 64
+#define DEFAULT_PENDING_MESSAGE_TIMEOUT 30000 /* milliseconds */
+
+struct SnXmessageData
+{
+  /* Every registered handler */
+  SnList *handlers;
+  /* Maps both type_atom and type_atom_begin to the list of
+   * handlers registered for that atom, so ClientMessages of
+   * any other type can be rejected with a single lookup
+   */
+  SnHash *handlers_by_atom;
+  /* Number of handlers not yet in handlers_by_atom */
+  int n_unindexed_handlers;
+  /* The keys of handlers_by_atom, rebuilt when they change */
+  xcb_atom_t *interesting_atoms;
+  int n_interesting_atoms;
+  sn_bool_t interesting_atoms_valid;
+  /* Bumped whenever a handler is added or an atom loses its last
+   * handler, so callers can tell interesting_atoms went stale
+   */
+  unsigned int interesting_atoms_serial;
+
+  /* Partially received messages, by identifying window, and
+   * ordered from newest to oldest
+   */
+  SnHash *pending_messages;
+  SnXmessage *newest_pending;
+  SnXmessage *oldest_pending;
+
+  int max_pending_messages;
+  int pending_message_timeout;
+
+  int n_evicted;
+  int n_expired;
+  int n_discarded;
+
+  /* Identifier windows kept around for outgoing messages, one
+   * per screen, when reuse_windows is set or a batch is open
+   */
+  sn_bool_t reuse_windows;
+  int batch_depth;
+  xcb_window_t *message_windows;
+  int n_message_windows;
+};
+
+SnXmessageData*
+sn_internal_xmessage_data_new (void)
+{
+  SnXmessageData *xmessage_data;
+
+  xmessage_data = sn_new0 (SnXmessageData, 1);
+
+  xmessage_data->handlers = sn_list_new ();
+  xmessage_data->handlers_by_atom = sn_hash_new (sn_direct_hash,
+                                                 sn_direct_equal);
+  xmessage_data->pending_messages = sn_hash_new (sn_direct_hash,
+                                                 sn_direct_equal);
+
+  xmessage_data->max_pending_messages = DEFAULT_MAX_PENDING_MESSAGES;
+  xmessage_data->pending_message_timeout = DEFAULT_PENDING_MESSAGE_TIMEOUT;
+
+  return xmessage_data;
+}
+
+static void message_free (SnXmessage *message);
+
+static sn_bool_t
+free_handler_list_foreach (void *key,
+                           void *value,
+                           void *data)
+{
+  sn_list_free (value);
+  return TRUE;
+}
+
+void
+sn_internal_xmessage_data_free (SnXmessageData *xmessage_data)
+{
+  while (xmessage_data->oldest_pending != NULL)
+    {
+      SnXmessage *message = xmessage_data->oldest_pending;
+
+      xmessage_data->oldest_pending = message->newer;
+      message_free (message);
+    }
+
+  sn_hash_foreach (xmessage_data->handlers_by_atom,
+                   free_handler_list_foreach, NULL);
+  sn_hash_free (xmessage_data->handlers_by_atom);
+  sn_list_free (xmessage_data->handlers);
+  sn_hash_free (xmessage_data->pending_messages);
+  sn_free (xmessage_data->interesting_atoms);
+  sn_free (xmessage_data->message_windows);
+  sn_free (xmessage_data);
+}
+
+void
+sn_internal_xmessage_set_pending_limits (SnXmessageData *xmessage_data,
+                                         int             max_messages,
+                                         int             max_age)
+{
+  xmessage_data->max_pending_messages = max_messages;
+  xmessage_data->pending_message_timeout = max_age;
+}
+
+void
+sn_internal_xmessage_get_pending_stats (SnXmessageData *xmessage_data,
+                                        int            *n_pending,
+                                        int            *n_evicted,
+                                        int            *n_expired,
+                                        int            *n_discarded)
+{
+  if (n_pending)
+    *n_pending = sn_hash_size (xmessage_data->pending_messages);
+  if (n_evicted)
+    *n_evicted = xmessage_data->n_evicted;
+  if (n_expired)
+    *n_expired = xmessage_data->n_expired;
+  if (n_discarded)
+    *n_discarded = xmessage_data->n_discarded;
+}
+
+static void
+destroy_message_windows (SnXmessageData   *xmessage_data,
+                         xcb_connection_t *xconnection)
+{
+  int i;
+
+  for (i = 0; i < xmessage_data->n_message_windows; ++i)
+    {
+      if (xmessage_data->message_windows[i] != XCB_WINDOW_NONE)
+        xcb_destroy_window (xconnection, xmessage_data->message_windows[i]);
+    }
+
+  sn_free (xmessage_data->message_windows);
+  xmessage_data->message_windows = NULL;
+  xmessage_data->n_message_windows = 0;
+}
+
+/* Outgoing requests are flushed after each message unless a
+ * batch is open, in which case sn_internal_xmessage_end_batch()
+ * flushes them all at once
+ */
+static void
+flush_messages (SnXmessageData   *xmessage_data,
+                xcb_connection_t *xconnection)
+{
+  if (xmessage_data->batch_depth == 0)
+    xcb_flush (xconnection);
+}
+
+void
+sn_internal_xmessage_set_reuse_windows (SnDisplay *display,
+                                        sn_bool_t  reuse)
+{
+  SnXmessageData *xmessage_data;
+  xcb_connection_t *xconnection;
+
+  xmessage_data = sn_internal_display_get_xmessage_data (display);
+  xmessage_data->reuse_windows = reuse;
+
+  /* A batch still needs its windows until it ends */
+  if (reuse || xmessage_data->batch_depth > 0 ||
+      xmessage_data->message_windows == NULL)
+    return;
+
+  xconnection = sn_display_get_x_connection (display);
+  destroy_message_windows (xmessage_data, xconnection);
+  xcb_flush (xconnection);
+}
+
+void
+sn_internal_xmessage_begin_batch (SnDisplay *display)
+{
+  sn_internal_display_get_xmessage_data (display)->batch_depth += 1;
+}
+
+void
+sn_internal_xmessage_end_batch (SnDisplay *display)
+{
+  SnXmessageData *xmessage_data;
+  xcb_connection_t *xconnection;
+
+  xmessage_data = sn_internal_display_get_xmessage_data (display);
+
+  if (xmessage_data->batch_depth == 0)
+    {
+      fprintf (stderr, "%s called without a matching begin\n",
+               "sn_display_end_batch");
+      return;
+    }
+
+  xmessage_data->batch_depth -= 1;
+  if (xmessage_data->batch_depth > 0)
+    return;
+
+  xconnection = sn_display_get_x_connection (display);
+  if (!xmessage_data->reuse_windows)
+    destroy_message_windows (xmessage_data, xconnection);
+  xcb_flush (xconnection);
+}
+
+void
+sn_internal_xmessage_release_windows (SnDisplay *display)
+{
+  SnXmessageData *xmessage_data;
+  xcb_connection_t *xconnection;
+
+  int i;
+
+  xmessage_data = sn_internal_display_get_xmessage_data (display);
+
+  /* Send nothing unless a window is actually cached, so a display
+   * that never sent a message can be freed without a connection
+   */
+  for (i = 0; i < xmessage_data->n_message_windows; ++i)
+    {
+      if (xmessage_data->message_windows[i] != XCB_WINDOW_NONE)
+        break;
+    }
+
+  if (i == xmessage_data->n_message_windows)
+    {
+      sn_free (xmessage_data->message_windows);
+      xmessage_data->message_windows = NULL;
+      xmessage_data->n_message_windows = 0;
+      return;
+    }
+
+  xconnection = sn_display_get_x_connection (display);
+  destroy_message_windows (xmessage_data, xconnection);
+  xcb_flush (xconnection);
+}
+
+static void
+index_handler (SnXmessageData    *xmessage_data,
+               xcb_atom_t         atom,
+               SnXmessageHandler *handler)
+{
+  SnList *handlers;
+
+  handlers = sn_hash_lookup (xmessage_data->handlers_by_atom,
+                             SN_UINT_TO_POINTER (atom));
+  if (handlers == NULL)
+    {
+      handlers = sn_list_new ();
+      sn_hash_insert (xmessage_data->handlers_by_atom,
+                      SN_UINT_TO_POINTER (atom), handlers);
+      xmessage_data->interesting_atoms_valid = FALSE;
+    }
+
+  sn_list_prepend (handlers, handler);
+}
+
+static void
+unindex_handler (SnXmessageData    *xmessage_data,
+                 xcb_atom_t         atom,
+                 SnXmessageHandler *handler)
+{
+  SnList *handlers;
+
+  handlers = sn_hash_lookup (xmessage_data->handlers_by_atom,
+                             SN_UINT_TO_POINTER (atom));
+  if (handlers == NULL)
+    return;
+
+  sn_list_remove (handlers, handler);
+
+  if (sn_list_empty (handlers))
+    {
+      sn_hash_remove (xmessage_data->handlers_by_atom,
+                      SN_UINT_TO_POINTER (atom));
+      sn_list_free (handlers);
+      xmessage_data->interesting_atoms_valid = FALSE;
+      xmessage_data->interesting_atoms_serial += 1;
+    }
+}
 
 void
 sn_internal_add_xmessage_func (SnDisplay      *display,
@@ -59,38 +366,72 @@ sn_internal_add_xmessage_func (SnDisplay      *display,
                                SnFreeFunc      free_data_func)
 {
   SnXmessageHandler *handler;
-  SnList *xmessage_funcs;
-  
-  xcb_connection_t *c = sn_display_get_x_connection(display);
-
-  /* Send atom requests ASAP */
-  xcb_intern_atom_cookie_t message_type_c =
-    xcb_intern_atom(c, FALSE, strlen(message_type), message_type);
-  xcb_intern_atom_cookie_t message_type_begin_c =
-    xcb_intern_atom(c, FALSE, strlen(message_type_begin), message_type_begin);
+  SnXmessageData *xmessage_data;
 
-  sn_internal_display_get_xmessage_data (display, &xmessage_funcs,
-                                         NULL);
+  xmessage_data = sn_internal_display_get_xmessage_data (display);
   
   handler = sn_new0 (SnXmessageHandler, 1);
 
-  handler->xid = sn_internal_display_get_id (display);
   handler->root = sn_internal_display_get_root_window (display, screen);
   handler->message_type = sn_internal_strdup (message_type);
   handler->func = func;
   handler->func_data = func_data;
   handler->free_data_func = free_data_func;
-  
-  xcb_intern_atom_reply_t *atom_reply;
-  atom_reply = xcb_intern_atom_reply(c, message_type_c, NULL);
-  handler->type_atom = atom_reply->atom;
-  free(atom_reply);
 
-  atom_reply = xcb_intern_atom_reply(c, message_type_begin_c, NULL);
-  handler->type_atom_begin = atom_reply->atom;
-  free(atom_reply);
+  /* Don't wait for the atoms until they are needed */
+  handler->lazy_type_atom =
+    sn_internal_display_intern_atom (display, message_type);
+  handler->lazy_type_atom_begin =
+    sn_internal_display_intern_atom (display, message_type_begin);
+
+  sn_list_prepend (xmessage_data->handlers, handler);
+  xmessage_data->n_unindexed_handlers += 1;
+  xmessage_data->interesting_atoms_serial += 1;
+}
+
+typedef struct
+{
+  SnDisplay *display;
+  SnXmessageData *xmessage_data;
+} IndexHandlerData;
+
+static sn_bool_t
+index_handler_foreach (void *value,
+                       void *data)
+{
+  SnXmessageHandler *handler = value;
+  IndexHandlerData *ihd = data;
+
+  if (handler->indexed)
+    return TRUE;
+
+  handler->type_atom =
+    sn_internal_display_get_atom (ihd->display, handler->lazy_type_atom);
+  handler->type_atom_begin =
+    sn_internal_display_get_atom (ihd->display, handler->lazy_type_atom_begin);
+  handler->indexed = TRUE;
+
+  index_handler (ihd->xmessage_data, handler->type_atom_begin, handler);
+  if (handler->type_atom != handler->type_atom_begin)
+    index_handler (ihd->xmessage_data, handler->type_atom, handler);
+
+  return TRUE;
+}
+
+static void
+index_new_handlers (SnDisplay      *display,
+                    SnXmessageData *xmessage_data)
+{
+  IndexHandlerData ihd;
+
+  if (xmessage_data->n_unindexed_handlers == 0)
+    return;
+
+  ihd.display = display;
+  ihd.xmessage_data = xmessage_data;
+  sn_list_foreach (xmessage_data->handlers, index_handler_foreach, &ihd);
 
-  sn_list_prepend (xmessage_funcs, handler);
+  xmessage_data->n_unindexed_handlers = 0;
 }
 
 typedef struct
@@ -129,10 +470,9 @@ sn_internal_remove_xmessage_func (SnDisplay      *display,
                                   void           *func_data)
 {
   FindHandlerData fhd;
-  SnList *xmessage_funcs;
+  SnXmessageData *xmessage_data;
 
-  sn_internal_display_get_xmessage_data (display, &xmessage_funcs,
-                                         NULL);
+  xmessage_data = sn_internal_display_get_xmessage_data (display);
 
   fhd.message_type = message_type;
   fhd.func = func;
@@ -140,12 +480,22 @@ sn_internal_remove_xmessage_func (SnDisplay      *display,
   fhd.handler = NULL;
   fhd.root = sn_internal_display_get_root_window (display, screen);
   
-  if (xmessage_funcs != NULL)
-    sn_list_foreach (xmessage_funcs, find_handler_foreach, &fhd);
+  sn_list_foreach (xmessage_data->handlers, find_handler_foreach, &fhd);
 
   if (fhd.handler != NULL)
     {
-      sn_list_remove (xmessage_funcs, fhd.handler);
+      sn_list_remove (xmessage_data->handlers, fhd.handler);
+
+      if (fhd.handler->indexed)
+        {
+          unindex_handler (xmessage_data, fhd.handler->type_atom_begin,
+                           fhd.handler);
+          if (fhd.handler->type_atom != fhd.handler->type_atom_begin)
+            unindex_handler (xmessage_data, fhd.handler->type_atom,
+                             fhd.handler);
+        }
+      else
+        xmessage_data->n_unindexed_handlers -= 1;
 
       sn_free (fhd.handler->message_type);
       
@@ -156,6 +506,74 @@ sn_internal_remove_xmessage_func (SnDisplay      *display,
     }
 }
 
+static sn_bool_t
+char_needs_escape (char c)
+{
+  return c == '\\' || c == '"' || c == ' ';
+}
+
+static xcb_window_t
+create_message_window (xcb_connection_t *xconnection,
+                       xcb_screen_t     *s)
+{
+  uint32_t attrs[] = { 1, XCB_EVENT_MASK_PROPERTY_CHANGE | XCB_EVENT_MASK_STRUCTURE_NOTIFY };
+  xcb_window_t xwindow;
+
+  xwindow = xcb_generate_id (xconnection);
+  xcb_create_window (xconnection, s->root_depth, xwindow, s->root,
+                     -100, -100, 1, 1, 0, XCB_COPY_FROM_PARENT, s->root_visual,
+                     XCB_CW_OVERRIDE_REDIRECT | XCB_CW_EVENT_MASK,
+                     attrs);
+
+  return xwindow;
+}
+
+/* Each message needs a window to identify it. A window can be
+ * reused once a message has been sent in full, since receivers
+ * see its chunks in order and only key on the window while a
+ * message is incomplete. Messages in a batch always share one.
+ */
+static xcb_window_t
+acquire_message_window (SnDisplay        *display,
+                        xcb_connection_t *xconnection,
+                        int               screen,
+                        xcb_screen_t     *s)
+{
+  SnXmessageData *xmessage_data;
+
+  xmessage_data = sn_internal_display_get_xmessage_data (display);
+
+  if (!xmessage_data->reuse_windows && xmessage_data->batch_depth == 0)
+    return create_message_window (xconnection, s);
+
+  if (xmessage_data->message_windows == NULL)
+    {
+      xmessage_data->n_message_windows =
+        sn_internal_display_get_screen_number (display);
+      xmessage_data->message_windows =
+        sn_new0 (xcb_window_t, xmessage_data->n_message_windows);
+    }
+
+  if (xmessage_data->message_windows[screen] == XCB_WINDOW_NONE)
+    xmessage_data->message_windows[screen] =
+      create_message_window (xconnection, s);
+
+  return xmessage_data->message_windows[screen];
+}
+
+static void
+release_message_window (SnDisplay        *display,
+                        xcb_connection_t *xconnection,
+                        xcb_window_t      xwindow)
+{
+  SnXmessageData *xmessage_data;
+
+  xmessage_data = sn_internal_display_get_xmessage_data (display);
+
+  if (!xmessage_data->reuse_windows && xmessage_data->batch_depth == 0)
+    xcb_destroy_window (xconnection, xwindow);
+}
+
 void
 sn_internal_broadcast_xmessage   (SnDisplay      *display,
                                   int             screen,
@@ -173,14 +591,10 @@ sn_internal_broadcast_xmessage   (SnDisplay      *display,
   
   xcb_connection_t *xconnection = sn_display_get_x_connection (display);
 
-  uint32_t attrs[] = { 1, XCB_EVENT_MASK_PROPERTY_CHANGE | XCB_EVENT_MASK_STRUCTURE_NOTIFY };
   xcb_screen_t *s = sn_internal_display_get_x_screen (display, screen);
 
-  xcb_window_t xwindow = xcb_generate_id(xconnection);
-  xcb_create_window(xconnection, s->root_depth, xwindow, s->root,
-                    -100, -100, 1, 1, 0, XCB_COPY_FROM_PARENT, s->root_visual,
-                    XCB_CW_OVERRIDE_REDIRECT | XCB_CW_EVENT_MASK,
-                    attrs);
+  xcb_window_t xwindow = acquire_message_window (display, xconnection,
+                                                 screen, s);
 
   {
       xcb_client_message_event_t xevent;
@@ -217,34 +631,148 @@ sn_internal_broadcast_xmessage   (SnDisplay      *display,
       }
   }
 
-  xcb_destroy_window (xconnection, xwindow);
-  xcb_flush(xconnection);
+  release_message_window (display, xconnection, xwindow);
+  flush_messages (sn_internal_display_get_xmessage_data (display),
+                  xconnection);
 }
 
+/* Accumulates message bytes in a ClientMessage and sends it
+ * each time its 20 bytes of payload are full.
+ */
 typedef struct
 {
-  void *xid;
-  xcb_atom_t atom;
-  xcb_window_t xwindow;
-  sn_bool_t found_handler;
-} HandlerForAtomData;
+  xcb_connection_t          *xconnection;
+  xcb_window_t               root;
+  xcb_atom_t                 message_type;
+  xcb_client_message_event_t xevent;
+  int                        used;
+} SnChunkWriter;
 
-static sn_bool_t
-handler_for_atom_foreach (void *value,
-                          void *data)
+static void
+chunk_writer_send (SnChunkWriter *writer)
 {
-  SnXmessageHandler *handler = value;
-  HandlerForAtomData *hfad = data;
-  
-  if (handler->xid == hfad->xid &&
-      (handler->type_atom == hfad->atom ||
-       handler->type_atom_begin == hfad->atom))
+  xcb_send_event (writer->xconnection, 0, writer->root,
+                  XCB_EVENT_MASK_PROPERTY_CHANGE,
+                  (char *) &writer->xevent);
+  writer->xevent.type = writer->message_type;
+  writer->used = 0;
+}
+
+static void
+chunk_writer_put (SnChunkWriter *writer,
+                  char           c)
+{
+  writer->xevent.data.data8[writer->used] = c;
+  ++writer->used;
+
+  if (writer->used == 20)
+    chunk_writer_send (writer);
+}
+
+static void
+chunk_writer_put_literal (SnChunkWriter *writer,
+                          const char    *str)
+{
+  for (; *str; ++str)
+    chunk_writer_put (writer, *str);
+}
+
+static void
+chunk_writer_put_escaped (SnChunkWriter *writer,
+                          const char    *str)
+{
+  for (; *str; ++str)
     {
-      hfad->found_handler = TRUE;
-      return FALSE;
+      if (char_needs_escape (*str))
+        chunk_writer_put (writer, '\\');
+      chunk_writer_put (writer, *str);
     }
-  else
-    return TRUE;
+}
+
+static void
+chunk_writer_finish (SnChunkWriter *writer)
+{
+  /* The nul terminator goes in the last chunk; pad the rest of it */
+  chunk_writer_put (writer, '\0');
+  if (writer->used > 0)
+    {
+      memset (&writer->xevent.data.data8[writer->used], 0,
+              20 - writer->used);
+      chunk_writer_send (writer);
+    }
+}
+
+/**
+ * sn_internal_broadcast_message:
+ * @display: an #SnDisplay
+ * @screen: screen to broadcast on
+ * @message_type: atom for the continuation chunks
+ * @message_type_begin: atom for the first chunk
+ * @prefix: message type, such as "new" or "remove"
+ * @property_names: %NULL-terminated array of key names
+ * @property_values: values for @property_names
+ *
+ * Like sn_internal_broadcast_xmessage(), but escapes the properties
+ * directly into the ClientMessage payloads rather than building the
+ * message as a string first, so no memory is allocated.
+ **/
+void
+sn_internal_broadcast_message (SnDisplay   *display,
+                               int          screen,
+                               xcb_atom_t   message_type,
+                               xcb_atom_t   message_type_begin,
+                               const char  *prefix,
+                               const char **property_names,
+                               const char **property_values)
+{
+  SnChunkWriter writer;
+  xcb_screen_t *s;
+  xcb_window_t xwindow;
+  int i;
+
+  /* Check everything before the first chunk goes out, since
+   * receivers would hold on to a partial message
+   */
+  for (i = 0; property_names[i]; ++i)
+    {
+      if (!sn_internal_utf8_validate (property_values[i], -1))
+        {
+          fprintf (stderr,
+                   "Attempted to send non-UTF-8 X message: %s: %s=%s\n",
+                   prefix, property_names[i], property_values[i]);
+          return;
+        }
+    }
+
+  writer.xconnection = sn_display_get_x_connection (display);
+  s = sn_internal_display_get_x_screen (display, screen);
+  xwindow = acquire_message_window (display, writer.xconnection,
+                                    screen, s);
+
+  writer.root = s->root;
+  writer.message_type = message_type;
+  writer.used = 0;
+  writer.xevent.response_type = XCB_CLIENT_MESSAGE;
+  writer.xevent.window = xwindow;
+  writer.xevent.format = 8;
+  writer.xevent.type = message_type_begin;
+
+  chunk_writer_put_literal (&writer, prefix);
+  chunk_writer_put (&writer, ':');
+
+  for (i = 0; property_names[i]; ++i)
+    {
+      chunk_writer_put (&writer, ' ');
+      chunk_writer_put_literal (&writer, property_names[i]);
+      chunk_writer_put (&writer, '=');
+      chunk_writer_put_escaped (&writer, property_values[i]);
+    }
+
+  chunk_writer_finish (&writer);
+
+  release_message_window (display, writer.xconnection, xwindow);
+  flush_messages (sn_internal_display_get_xmessage_data (display),
+                  writer.xconnection);
 }
 
 static sn_bool_t
@@ -252,45 +780,82 @@ some_handler_handles_event (SnDisplay *display,
                             xcb_atom_t atom,
                             xcb_window_t win)
 {
-  HandlerForAtomData hfad;
-  SnList *xmessage_funcs;
+  SnXmessageData *xmessage_data;
 
-  sn_internal_display_get_xmessage_data (display, &xmessage_funcs,
-                                         NULL);
-  
-  hfad.atom = atom;
-  hfad.xid = sn_internal_display_get_id (display);
-  hfad.xwindow = win;
-  hfad.found_handler = FALSE;
+  xmessage_data = sn_internal_display_get_xmessage_data (display);
 
-  if (xmessage_funcs)
-    sn_list_foreach (xmessage_funcs,
-                     handler_for_atom_foreach,
-                     &hfad);
+  index_new_handlers (display, xmessage_data);
 
-  return hfad.found_handler;
+  return sn_hash_lookup (xmessage_data->handlers_by_atom,
+                         SN_UINT_TO_POINTER (atom)) != NULL;
 }
 
-typedef struct
-{
-  xcb_window_t window;
-  SnXmessage *message;
-} FindMessageData;
-
 static sn_bool_t
-find_message_foreach (void *value,
+collect_atom_foreach (void *key,
+                      void *value,
                       void *data)
 {
-  SnXmessage *message = value;
-  FindMessageData *fmd = data;
-  
-  if (fmd->window == message->xwindow)
+  SnXmessageData *xmessage_data = data;
+
+  xmessage_data->interesting_atoms[xmessage_data->n_interesting_atoms] =
+    SN_POINTER_TO_UINT (key);
+  xmessage_data->n_interesting_atoms += 1;
+
+  return TRUE;
+}
+
+const xcb_atom_t*
+sn_internal_xmessage_get_interesting_atoms (SnDisplay    *display,
+                                            int          *n_atoms,
+                                            unsigned int *serial)
+{
+  SnXmessageData *xmessage_data;
+
+  xmessage_data = sn_internal_display_get_xmessage_data (display);
+
+  index_new_handlers (display, xmessage_data);
+
+  if (!xmessage_data->interesting_atoms_valid)
     {
-      fmd->message = message;
-      return FALSE;
+      sn_free (xmessage_data->interesting_atoms);
+      xmessage_data->interesting_atoms =
+        sn_new (xcb_atom_t, sn_hash_size (xmessage_data->handlers_by_atom) + 1);
+      xmessage_data->n_interesting_atoms = 0;
+      sn_hash_foreach (xmessage_data->handlers_by_atom,
+                       collect_atom_foreach, xmessage_data);
+      xmessage_data->interesting_atoms_valid = TRUE;
     }
 
-  return TRUE;
+  *n_atoms = xmessage_data->n_interesting_atoms;
+  if (serial)
+    *serial = xmessage_data->interesting_atoms_serial;
+
+  return xmessage_data->interesting_atoms;
+}
+
+unsigned int
+sn_internal_xmessage_get_interesting_atoms_serial (SnDisplay *display)
+{
+  return sn_internal_display_get_xmessage_data (display)->interesting_atoms_serial;
+}
+
+sn_bool_t
+sn_internal_xmessage_event_is_interesting (SnDisplay    *display,
+                                           xcb_window_t  window,
+                                           xcb_atom_t    type)
+{
+  SnXmessageData *xmessage_data;
+
+  xmessage_data = sn_internal_display_get_xmessage_data (display);
+
+  /* Indexing new handlers may wait on InternAtom replies, so leave
+   * that to the real processing and let the event through
+   */
+  if (xmessage_data->n_unindexed_handlers > 0)
+    return TRUE;
+
+  return sn_hash_lookup (xmessage_data->handlers_by_atom,
+                         SN_UINT_TO_POINTER (type)) != NULL;
 }
 
 static SnXmessage*
@@ -300,64 +865,239 @@ message_new(xcb_atom_t type_atom_begin, xcb_window_t win)
   message->type_atom_begin = type_atom_begin;
   message->xwindow = win;
   message->message = NULL;
+  message->length = 0;
   message->allocated = 0;
   return message;
 }
 
+static void
+message_free (SnXmessage *message)
+{
+  sn_free (message->message);
+  sn_free (message);
+}
+
 static sn_bool_t
 message_set_message(SnXmessage *message, const char *src)
 {
-  const char *src_end;
-  char *dest;
-  sn_bool_t completed = FALSE;
+  const char *nul;
+  int len;
 
-  src_end = src + 20;
+  /* Copy bytes, be sure we get nul byte also */
+  nul = memchr (src, '\0', 20);
+  len = nul ? (nul - src) + 1 : 20;
 
-  message->message = sn_realloc (message->message,
-                                 message->allocated + (src_end - src));
-  dest = message->message + message->allocated;
-  message->allocated += (src_end - src);
+  if (message->length + len > message->allocated)
+    {
+      int allocated;
 
-  /* Copy bytes, be sure we get nul byte also */
-  while (src != src_end)
+      allocated = message->allocated ?
+        message->allocated * 2 : INITIAL_MESSAGE_ALLOCATION;
+      while (allocated < message->length + len)
+        allocated *= 2;
+
+      message->message = sn_realloc (message->message, allocated);
+      message->allocated = allocated;
+    }
+
+  memcpy (message->message + message->length, src, len);
+
+  if (nul)
     {
-      *dest = *src;
+      message->length += len - 1;
+      return TRUE;
+    }
 
-      if (*src == '\0')
-        {
-          completed = TRUE;
-          break;
-        }
+  message->length += len;
 
-      ++dest;
-      ++src;
+  return FALSE;
+}
+
+static void
+unlink_pending_message (SnXmessageData *xmessage_data,
+                        SnXmessage     *message)
+{
+  if (message->newer)
+    message->newer->older = message->older;
+  else
+    xmessage_data->newest_pending = message->older;
+
+  if (message->older)
+    message->older->newer = message->newer;
+  else
+    xmessage_data->oldest_pending = message->newer;
+
+  message->newer = NULL;
+  message->older = NULL;
+}
+
+static void
+link_pending_message (SnXmessageData *xmessage_data,
+                      SnXmessage     *message)
+{
+  message->older = xmessage_data->newest_pending;
+  message->newer = NULL;
+
+  if (xmessage_data->newest_pending)
+    xmessage_data->newest_pending->newer = message;
+  else
+    xmessage_data->oldest_pending = message;
+
+  xmessage_data->newest_pending = message;
+}
+
+static void
+remove_pending_message (SnXmessageData *xmessage_data,
+                        SnXmessage     *message)
+{
+  sn_hash_remove (xmessage_data->pending_messages,
+                  SN_UINT_TO_POINTER (message->xwindow));
+  unlink_pending_message (xmessage_data, message);
+}
+
+/* Drop the oldest partial messages while there are too many of
+ * them, or they have been pending for too long. Called when a new
+ * message is started, which is passed as @keep and never dropped,
+ * and from sn_internal_xmessage_dispatch_timeouts().
+ */
+static void
+evict_pending_messages (SnXmessageData *xmessage_data,
+                        unsigned long   now,
+                        SnXmessage     *keep)
+{
+  while (xmessage_data->oldest_pending != NULL &&
+         xmessage_data->oldest_pending != keep)
+    {
+      SnXmessage *oldest = xmessage_data->oldest_pending;
+
+      if (xmessage_data->max_pending_messages > 0 &&
+          sn_hash_size (xmessage_data->pending_messages) >
+          xmessage_data->max_pending_messages)
+        xmessage_data->n_evicted += 1;
+      else if (xmessage_data->pending_message_timeout > 0 &&
+               now - oldest->started >=
+               (unsigned long) xmessage_data->pending_message_timeout)
+        xmessage_data->n_expired += 1;
+      else
+        break;
+
+      remove_pending_message (xmessage_data, oldest);
+      message_free (oldest);
     }
+}
+
+int
+sn_internal_xmessage_get_next_timeout (SnDisplay *display)
+{
+  SnXmessageData *xmessage_data;
+  unsigned long elapsed;
+
+  xmessage_data = sn_internal_display_get_xmessage_data (display);
 
-  return completed;
+  if (xmessage_data->oldest_pending == NULL ||
+      xmessage_data->pending_message_timeout <= 0)
+    return -1;
+
+  elapsed = sn_internal_get_monotonic_msec () -
+    xmessage_data->oldest_pending->started;
+  if (elapsed >= (unsigned long) xmessage_data->pending_message_timeout)
+    return 0;
+
+  return xmessage_data->pending_message_timeout - (int) elapsed;
+}
+
+void
+sn_internal_xmessage_dispatch_timeouts (SnDisplay *display)
+{
+  SnXmessageData *xmessage_data;
+
+  xmessage_data = sn_internal_display_get_xmessage_data (display);
+
+  if (xmessage_data->oldest_pending == NULL)
+    return;
+
+  evict_pending_messages (xmessage_data, sn_internal_get_monotonic_msec (),
+                          NULL);
+}
+
+typedef struct
+{
+  xcb_atom_t atom;
+  sn_bool_t starts_message;
+} StartsMessageData;
+
+static sn_bool_t
+starts_message_foreach (void *value,
+                        void *data)
+{
+  SnXmessageHandler *handler = value;
+  StartsMessageData *smd = data;
+
+  if (handler->type_atom_begin == smd->atom &&
+      handler->type_atom != handler->type_atom_begin)
+    {
+      smd->starts_message = TRUE;
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Whether a chunk of type @atom is the first of a message. Handlers
+ * using the same atom for the first chunk and the rest can't tell.
+ */
+static sn_bool_t
+chunk_starts_message (SnXmessageData *xmessage_data,
+                      xcb_atom_t      atom)
+{
+  StartsMessageData smd;
+  SnList *handlers;
+
+  handlers = sn_hash_lookup (xmessage_data->handlers_by_atom,
+                             SN_UINT_TO_POINTER (atom));
+  if (handlers == NULL)
+    return FALSE;
+
+  smd.atom = atom;
+  smd.starts_message = FALSE;
+  sn_list_foreach (handlers, starts_message_foreach, &smd);
+
+  return smd.starts_message;
 }
 
 static SnXmessage*
-get_or_add_message(SnList *pending_messages,
+get_or_add_message(SnXmessageData *xmessage_data,
                    xcb_window_t win,
                    xcb_atom_t type_atom_begin)
 {
-  FindMessageData fmd;
   SnXmessage *message;
 
-  fmd.window = win;
-  fmd.message = NULL;
-
-  
-  if (pending_messages)
-    sn_list_foreach (pending_messages, find_message_foreach, &fmd);
+  message = sn_hash_lookup (xmessage_data->pending_messages,
+                            SN_UINT_TO_POINTER (win));
 
-  message = fmd.message;
+  /* A second first chunk for the same window means the sender
+   * reused the window and the earlier message was abandoned
+   */
+  if (message != NULL &&
+      message->type_atom_begin == type_atom_begin &&
+      chunk_starts_message (xmessage_data, type_atom_begin))
+    {
+      remove_pending_message (xmessage_data, message);
+      message_free (message);
+      message = NULL;
+    }
 
   if (message == NULL)
     {
       message = message_new(type_atom_begin, win);
 
-      sn_list_prepend (pending_messages, message);
+      sn_hash_insert (xmessage_data->pending_messages,
+                      SN_UINT_TO_POINTER (win), message);
+
+      message->started = sn_internal_get_monotonic_msec ();
+      link_pending_message (xmessage_data, message);
+
+      evict_pending_messages (xmessage_data, message->started, message);
     }
   
   return message;
@@ -370,32 +1110,26 @@ add_event_to_messages (SnDisplay *display,
                        const char *data)
 {
   SnXmessage *message;
-  SnList *pending_messages;
+  SnXmessageData *xmessage_data;
 
-  sn_internal_display_get_xmessage_data (display, NULL,
-                                         &pending_messages);
+  xmessage_data = sn_internal_display_get_xmessage_data (display);
 
-  message = get_or_add_message(pending_messages,
+  message = get_or_add_message(xmessage_data,
                                win, message_type);
 
-  /* We don't want screwy situations to end up causing us to allocate
-   * infinite memory. Cap the length of a message.
-   */
-#define MAX_MESSAGE_LENGTH 4096
-
-  if (message->allocated > MAX_MESSAGE_LENGTH)
+  if (message->length > MAX_MESSAGE_LENGTH)
     {
       /* This message is some kind of crap - just dump it. */
-      sn_free (message->message);
-      sn_list_remove (pending_messages, message);
-      sn_free (message);
+      remove_pending_message (xmessage_data, message);
+      message_free (message);
+      xmessage_data->n_discarded += 1;
       return NULL;
     }
   
   if (message_set_message (message, data))
     {
       /* Pull message out of the pending queue and return it */
-      sn_list_remove (pending_messages, message);
+      remove_pending_message (xmessage_data, message);
       return message;
     }
   else
@@ -415,11 +1149,11 @@ dispatch_message_foreach (void *value,
   SnXmessageHandler *handler = value;
   MessageDispatchData *mdd = data;  
   
-  if (handler->type_atom_begin == mdd->message->type_atom_begin &&
-      sn_internal_display_get_id (mdd->display) == handler->xid)
+  if (handler->type_atom_begin == mdd->message->type_atom_begin)
     (* handler->func) (mdd->display,
                        handler->message_type,
                        mdd->message->message,
+                       mdd->message->length,
                        handler->func_data);
   
   return TRUE;
@@ -434,13 +1168,14 @@ xmessage_process_message (SnDisplay *display, SnXmessage *message)
        * messages containing invalid UTF-8
        */
 
-      if (sn_internal_utf8_validate (message->message, -1))
+      if (sn_internal_utf8_validate (message->message, message->length))
         {
           MessageDispatchData mdd;
-          SnList *xmessage_funcs;
+          SnList *handlers;
           
-          sn_internal_display_get_xmessage_data (display, &xmessage_funcs,
-                                                 NULL);
+          handlers =
+            sn_hash_lookup (sn_internal_display_get_xmessage_data (display)->handlers_by_atom,
+                            SN_UINT_TO_POINTER (message->type_atom_begin));
           
           mdd.display = display;
           mdd.message = message;
@@ -449,8 +1184,8 @@ xmessage_process_message (SnDisplay *display, SnXmessage *message)
            * barf if you add/remove a handler from inside the
            * dispatch
            */
-          if (xmessage_funcs != NULL)
-            sn_list_foreach (xmessage_funcs,
+          if (handlers != NULL)
+            sn_list_foreach (handlers,
                              dispatch_message_foreach,
                              &mdd);
         }
@@ -460,8 +1195,7 @@ xmessage_process_message (SnDisplay *display, SnXmessage *message)
           fprintf (stderr, "Bad UTF-8 in startup notification message\n");
         }
 
-      sn_free (message->message);
-      sn_free (message);
+      message_free (message);
     }
 }
 
@@ -486,253 +1220,386 @@ sn_internal_xmessage_process_client_message (SnDisplay   *display,
   return retval;
 }
 
-static void
-sn_internal_append_to_string_escaped (char      **append_to,
-                                      int        *current_len,
-                                      const char *append)
+/**
+ * sn_internal_xmessage_process_events:
+ * @display: an #SnDisplay
+ * @events: events to process
+ * @n_events: number of events
+ * @handled_mask: bit mask of @n_events bits to set for the events
+ * that were handled, or %NULL
+ *
+ * Like sn_internal_xmessage_process_client_message() on each
+ * ClientMessage among @events, except that messages completed by the
+ * batch are only dispatched once every event has been looked at.
+ *
+ * Return value: the number of events handled
+ **/
+int
+sn_internal_xmessage_process_events (SnDisplay            *display,
+                                     xcb_generic_event_t **events,
+                                     int                   n_events,
+                                     unsigned char        *handled_mask)
 {
-  char *escaped;
-  int len;
-  char buf[2];
-  const char *p;
+  SnXmessageData *xmessage_data;
+  SnXmessage *first_complete;
+  SnXmessage *last_complete;
+  xcb_atom_t last_type;
+  sn_bool_t last_type_handled;
+  int n_handled;
+  int i;
 
-  buf[1] = '\0';
-  len = 0;
-  escaped = NULL;
+  xmessage_data = sn_internal_display_get_xmessage_data (display);
+
+  index_new_handlers (display, xmessage_data);
+
+  if (handled_mask)
+    memset (handled_mask, 0, (n_events + 7) / 8);
+
+  /* Completed messages, linked through newer */
+  first_complete = NULL;
+  last_complete = NULL;
+
+  /* Chunks of one message come in a row and mostly share a type */
+  last_type = XCB_ATOM_NONE;
+  last_type_handled = FALSE;
 
-  /* We are the most inefficient algorithm ever! woot! */
-  /* really need GString here */
-  p = append;
-  while (*p)
+  n_handled = 0;
+  for (i = 0; i < n_events; ++i)
     {
-      if (*p == '\\' || *p == '"' || *p == ' ')
+      xcb_client_message_event_t *ev;
+      SnXmessage *message;
+
+      if (XCB_EVENT_RESPONSE_TYPE (events[i]) != XCB_CLIENT_MESSAGE)
+        continue;
+
+      ev = (xcb_client_message_event_t*) events[i];
+
+      if (ev->type != last_type)
         {
-          buf[0] = '\\';
-          sn_internal_append_to_string (&escaped, &len, buf);
+          last_type = ev->type;
+          last_type_handled =
+            sn_hash_lookup (xmessage_data->handlers_by_atom,
+                            SN_UINT_TO_POINTER (ev->type)) != NULL;
+        }
+
+      if (!last_type_handled)
+        continue;
+
+      n_handled += 1;
+      if (handled_mask)
+        handled_mask[i / 8] |= 1 << (i % 8);
+
+      message = add_event_to_messages (display, ev->window, ev->type,
+                                       (const char*) ev->data.data8);
+      if (message)
+        {
+          if (last_complete)
+            last_complete->newer = message;
+          else
+            first_complete = message;
+          last_complete = message;
         }
-      buf[0] = *p;
-      sn_internal_append_to_string (&escaped, &len, buf);
-      
-      ++p;
     }
 
-  if (escaped != NULL)
+  while (first_complete != NULL)
     {
-      sn_internal_append_to_string (append_to, current_len, escaped);
-      
-      sn_free (escaped);
+      SnXmessage *message = first_complete;
+
+      first_complete = message->newer;
+      xmessage_process_message (display, message);
     }
+
+  return n_handled;
 }
 
-char*
-sn_internal_serialize_message (const char   *prefix,
-                               const char  **property_names,
-                               const char  **property_values)
+static int
+escaped_length (const char *str)
 {
+  const char *p;
   int len;
-  char *retval;
-  int i;
-  
-  /* GLib would simplify this a lot... */  
+
   len = 0;
-  retval = NULL;
+  for (p = str; *p; ++p)
+    {
+      if (char_needs_escape (*p))
+        ++len;
+      ++len;
+    }
+
+  return len;
+}
 
-  sn_internal_append_to_string (&retval, &len, prefix);
-  sn_internal_append_to_string (&retval, &len, ":");
+static char*
+append_escaped (char       *dest,
+                const char *str)
+{
+  const char *p;
 
-  i = 0;
-  while (property_names[i])
+  for (p = str; *p; ++p)
     {
-      sn_internal_append_to_string (&retval, &len, " ");
-      sn_internal_append_to_string (&retval, &len, property_names[i]);
-      sn_internal_append_to_string (&retval, &len, "=");
-      sn_internal_append_to_string_escaped (&retval, &len, property_values[i]);
-      
-      ++i;
+      if (char_needs_escape (*p))
+        *dest++ = '\\';
+      *dest++ = *p;
     }
 
-  return retval;
+  return dest;
 }
 
-/* Takes ownership of @append
- */
-static void
-append_string_to_list (char ***list,
-                       char   *append)
+static char*
+append_literal (char       *dest,
+                const char *str,
+                int         len)
+{
+  memcpy (dest, str, len);
+  return dest + len;
+}
+
+/**
+ * sn_internal_serialize_message_to_buffer:
+ * @prefix: message type
+ * @property_names: %NULL-terminated array of key names
+ * @property_values: values for @property_names
+ * @buffer: buffer to write the message into, or %NULL
+ * @buffer_len: size of @buffer
+ *
+ * Serializes a message into @buffer if it is large enough, including
+ * the nul terminator. Nothing is written if it is too small; call
+ * with a %NULL @buffer to find out the size needed.
+ *
+ * Return value: the size of buffer needed, including the nul byte
+ **/
+int
+sn_internal_serialize_message_to_buffer (const char   *prefix,
+                                         const char  **property_names,
+                                         const char  **property_values,
+                                         char         *buffer,
+                                         int           buffer_len)
 {
-  if (*list == NULL)
+  int needed;
+  char *dest;
+  int i;
+
+  /* "prefix:" then " name=value" for each property, and a nul */
+  needed = strlen (prefix) + 1 + 1;
+  for (i = 0; property_names[i]; ++i)
+    needed += 1 + strlen (property_names[i]) + 1 +
+      escaped_length (property_values[i]);
+
+  if (buffer == NULL || buffer_len < needed)
+    return needed;
+
+  dest = append_literal (buffer, prefix, strlen (prefix));
+  *dest++ = ':';
+
+  for (i = 0; property_names[i]; ++i)
     {
-      *list = sn_new0 (char*, 2);
-      (*list)[0] = append;
+      *dest++ = ' ';
+      dest = append_literal (dest, property_names[i],
+                             strlen (property_names[i]));
+      *dest++ = '=';
+      dest = append_escaped (dest, property_values[i]);
     }
-  else
-    {
-      int i;
 
-      i = 0;
-      while ((*list)[i] != NULL)
-        ++i;
+  *dest = '\0';
 
-      *list = sn_renew (char*, *list, i + 2);
-      (*list)[i] = append;
-      (*list)[i+1] = NULL;
-    }
+  return needed;
 }
 
-static char*
-parse_prefix_up_to (const char *str,
-                    int         up_to,
-                    const char **end)
+char*
+sn_internal_serialize_message (const char   *prefix,
+                               const char  **property_names,
+                               const char  **property_values)
 {
-  char *prefix;
-  const char *p;
   int len;
-  
-  prefix = NULL;
-  *end = NULL;
-  
-  p = str;
-  while (*p && *p != up_to)
-    ++p;
+  char *retval;
 
-  if (*p == '\0')
-    return NULL;
+  len = sn_internal_serialize_message_to_buffer (prefix,
+                                                 property_names,
+                                                 property_values,
+                                                 NULL, 0);
+  retval = sn_malloc (len);
+  sn_internal_serialize_message_to_buffer (prefix,
+                                           property_names,
+                                           property_values,
+                                           retval, len);
 
-  len = p - str;
-  prefix = sn_internal_strndup (str, len);
+  return retval;
+}
 
-  *end = str + len;
+static void
+append_property (SnParsedMessage *parsed,
+                 const char      *name,
+                 int              name_len,
+                 const char      *value,
+                 int              value_len)
+{
+  SnMessageProperty *property;
 
-  return prefix;
-}                    
+  if (parsed->n_properties == parsed->allocated_properties)
+    {
+      parsed->allocated_properties *= 2;
+
+      if (parsed->properties == parsed->inline_properties)
+        {
+          parsed->properties = sn_new (SnMessageProperty,
+                                       parsed->allocated_properties);
+          memcpy (parsed->properties, parsed->inline_properties,
+                  sizeof (parsed->inline_properties));
+        }
+      else
+        parsed->properties = sn_renew (SnMessageProperty,
+                                       parsed->properties,
+                                       parsed->allocated_properties);
+    }
 
+  property = &parsed->properties[parsed->n_properties];
+  property->name = name;
+  property->name_len = name_len;
+  property->value = value;
+  property->value_len = value_len;
+
+  parsed->n_properties += 1;
+}
 
-/* Single quotes preserve the literal string exactly. escape
- * sequences are not allowed; not even \' - if you want a '
- * in the quoted text, you have to do something like 'foo'\''bar'
+/**
+ * sn_internal_parse_message:
+ * @message: a key-value string as described in startup-notification.txt
+ * @len: length of @message, or -1 if it is nul-terminated
+ * @parsed: structure to fill in
  *
- * Double quotes allow $ ` " \ and newline to be escaped with backslash.
- * Otherwise double quotes preserve things literally.
+ * Parses @message in a single pass. The prefix, key names and
+ * unescaped values are written, nul-terminated, into one buffer owned
+ * by @parsed, and are returned as slices of it. If the message is
+ * corrupt it is discarded as a whole, as the spec requires.
  *
- * (This is overkill for X messages, copied from GLib shell code,
- *  copyright Red Hat Inc. also)
- */
-
-static sn_bool_t
-unescape_string_inplace (char  *str,
-                         char **end)
+ * On success, free the result with sn_internal_parsed_message_free().
+ *
+ * Return value: %TRUE if @message was valid
+ **/
+sn_bool_t
+sn_internal_parse_message (const char      *message,
+                           int              len,
+                           SnParsedMessage *parsed)
 {
-  char* dest;
-  char* s;
-  sn_bool_t escaped;
-  sn_bool_t quoted;  
-  
-  dest = s = str;
-  escaped = FALSE;
-  quoted = FALSE;
-  
-  while (*s)
-    {      
-      if (escaped)
+  const char *src;
+  char *dest;
+
+  if (len < 0)
+    len = strlen (message);
+
+  parsed->buffer = sn_malloc (len + 1);
+  parsed->properties = parsed->inline_properties;
+  parsed->n_properties = 0;
+  parsed->allocated_properties = SN_MESSAGE_INLINE_PROPERTIES;
+
+  src = message;
+  dest = parsed->buffer;
+
+  /* All bytes up to the first ':' are the message type */
+  parsed->prefix = dest;
+  while (*src != ':')
+    {
+      if (*src == '\0')
+        goto corrupt;
+
+      *dest++ = *src++;
+    }
+  parsed->prefix_len = dest - parsed->prefix;
+  *dest++ = '\0';
+  ++src;
+
+  while (TRUE)
+    {
+      const char *name;
+      int name_len;
+      const char *value;
+      sn_bool_t escaped;
+      sn_bool_t quoted;
+
+      while (*src == ' ')
+        ++src;
+
+      if (*src == '\0')
+        break;
+
+      /* All bytes until the next '=' are the key */
+      name = dest;
+      while (*src != '=')
         {
-          escaped = FALSE;
-          
-          *dest = *s;
-          ++dest;
+          /* a trailing key without a value is ignored */
+          if (*src == '\0')
+            goto out;
+
+          *dest++ = *src++;
         }
-      else if (quoted)
+      name_len = dest - name;
+      *dest++ = '\0';
+      ++src;
+
+      /* The value starts right after the '=' */
+      value = dest;
+      escaped = FALSE;
+      quoted = FALSE;
+      while (TRUE)
         {
-          if (*s == '"')
-            quoted = FALSE;
-          else if (*s == '\\')
-            escaped = TRUE;
-          else
+          if (*src == '\0')
             {
-              *dest = *s;
-              ++dest;
+              if (escaped || quoted)
+                goto corrupt;
+              break;
+            }
+
+          if (escaped)
+            {
+              escaped = FALSE;
+              *dest++ = *src;
+            }
+          else if (quoted)
+            {
+              if (*src == '"')
+                quoted = FALSE;
+              else if (*src == '\\')
+                escaped = TRUE;
+              else
+                *dest++ = *src;
             }
-        }
-      else
-        {
-          if (*s == ' ')
-            break;
-          else if (*s == '\\')
-            escaped = TRUE;
-          else if (*s == '"')
-            quoted = TRUE;
           else
             {
-              *dest = *s;
-              ++dest;
+              if (*src == ' ')
+                break;
+              else if (*src == '\\')
+                escaped = TRUE;
+              else if (*src == '"')
+                quoted = TRUE;
+              else
+                *dest++ = *src;
             }
+
+          ++src;
         }
 
-      ++s;
+      append_property (parsed, name, name_len, value, dest - value);
+      *dest++ = '\0';
     }
 
-  *dest = '\0';
-  *end = s;
-  
+ out:
   return TRUE;
-}
-
-static sn_bool_t
-parse_property (const char  *str,
-                char       **name_p,
-                char       **val_p,
-                const char **end_p)
-{
-  char *val;
-  char *name;
-  char *copy;  
-  char *p;
-  
-  *end_p = NULL;
-
-  copy = sn_internal_strdup (str);
-  p = copy;
-  
-  while (*p == ' ')
-    ++p;
 
-  name = parse_prefix_up_to (p, '=', (const char**) &p);
-  if (name == NULL)
-    {
-      sn_free (copy);
-      return FALSE;
-    }
-  ++p; /* skip '=' */
-
-  while (*p == ' ')
-    ++p;
-
-  {
-    char *end;
-    
-    end = NULL;
-    if (!unescape_string_inplace (p, &end))
-      {
-        sn_free (copy);
-        sn_free (name);
-        return FALSE;
-      }
-
-    val = sn_internal_strndup (p, end - p);
-    
-    p = end;
-  }
+ corrupt:
+  sn_internal_parsed_message_free (parsed);
+  return FALSE;
+}
 
-  while (*p == ' ')
-    ++p;
-  
-  *end_p = str + (p - copy);
-  
-  sn_free (copy);
-  
-  *name_p = name;
-  *val_p = val;
+void
+sn_internal_parsed_message_free (SnParsedMessage *parsed)
+{
+  if (parsed->properties != parsed->inline_properties)
+    sn_free (parsed->properties);
+  sn_free (parsed->buffer);
 
-  return TRUE;
+  parsed->buffer = NULL;
+  parsed->properties = NULL;
+  parsed->n_properties = 0;
 }
 
 sn_bool_t
@@ -741,39 +1608,36 @@ sn_internal_unserialize_message (const char *message,
                                  char     ***property_names,
                                  char     ***property_values)
 {
-  /* GLib would simplify this a lot... */
-  char *prefix;
+  SnParsedMessage parsed;
   char **names;
   char **values;
-  const char *p;
-  char *name;
-  char *value;
+  int i;
   
   *prefix_p = NULL;
   *property_names = NULL;
   *property_values = NULL;
   
-  prefix = NULL;
-  names = NULL;
-  values = NULL;
-
-  prefix = parse_prefix_up_to (message, ':', &p);
-  if (prefix == NULL)
+  if (!sn_internal_parse_message (message, -1, &parsed))
     return FALSE;
 
-  ++p; /* skip ':' */
+  names = sn_new (char*, parsed.n_properties + 1);
+  values = sn_new (char*, parsed.n_properties + 1);
 
-  name = NULL;
-  value = NULL;
-  while (parse_property (p, &name, &value, &p))
+  for (i = 0; i < parsed.n_properties; ++i)
     {
-      append_string_to_list (&names, name);
-      append_string_to_list (&values, value);
+      names[i] = sn_internal_strndup (parsed.properties[i].name,
+                                      parsed.properties[i].name_len);
+      values[i] = sn_internal_strndup (parsed.properties[i].value,
+                                       parsed.properties[i].value_len);
     }
-  
-  *prefix_p = prefix;
+  names[i] = NULL;
+  values[i] = NULL;
+
+  *prefix_p = sn_internal_strndup (parsed.prefix, parsed.prefix_len);
   *property_names = names;
   *property_values = values;
 
+  sn_internal_parsed_message_free (&parsed);
+
   return TRUE;
 }
@@ -29,9 +29,13 @@
 
 SN_BEGIN_DECLS
 
+/* @message is nul-terminated, and @message_len bytes long without
+ * the nul
+ */
 typedef void (* SnXmessageFunc) (SnDisplay       *display,
                                  const char      *message_type,
                                  const char      *message,
+                                 int              message_len,
                                  void            *user_data);
 
 void sn_internal_add_xmessage_func    (SnDisplay      *display,
@@ -51,10 +55,48 @@ void sn_internal_broadcast_xmessage   (SnDisplay      *display,
                                        xcb_atom_t      message_type,
                                        xcb_atom_t      message_type_begin,
                                        const char     *message);
+void sn_internal_broadcast_message    (SnDisplay      *display,
+                                       int             screen,
+                                       xcb_atom_t      message_type,
+                                       xcb_atom_t      message_type_begin,
+                                       const char     *prefix,
+                                       const char    **property_names,
+                                       const char    **property_values);
+
+typedef struct
+{
+  const char *name;
+  int         name_len;
+  const char *value;
+  int         value_len;
+} SnMessageProperty;
+
+#define SN_MESSAGE_INLINE_PROPERTIES 16
+
+typedef struct
+{
+  char              *buffer;
+  const char        *prefix;
+  int                prefix_len;
+  SnMessageProperty *properties;
+  int                n_properties;
+  int                allocated_properties;
+  SnMessageProperty  inline_properties[SN_MESSAGE_INLINE_PROPERTIES];
+} SnParsedMessage;
+
+sn_bool_t sn_internal_parse_message       (const char      *message,
+                                           int              len,
+                                           SnParsedMessage *parsed);
+void      sn_internal_parsed_message_free (SnParsedMessage *parsed);
 
 char*     sn_internal_serialize_message   (const char   *prefix,
                                            const char  **property_names,
                                            const char  **property_values);
+int       sn_internal_serialize_message_to_buffer (const char   *prefix,
+                                                   const char  **property_names,
+                                                   const char  **property_values,
+                                                   char         *buffer,
+                                                   int           buffer_len);
 sn_bool_t sn_internal_unserialize_message (const char   *message,
                                            char        **prefix,
                                            char       ***property_names,
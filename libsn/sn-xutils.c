@@ -47,3 +47,150 @@ sn_internal_set_utf8_string (SnDisplay  *display,
 
   sn_display_error_trap_pop (display);
 }
+
+/* Longest property value read, in 32-bit units */
+#define MAX_PROPERTY_LENGTH 1024
+
+static char*
+get_utf8_string_reply (SnDisplay                 *display,
+                       xcb_get_property_cookie_t  cookie)
+{
+  xcb_get_property_reply_t *reply;
+  char *str;
+
+  str = NULL;
+
+  reply = xcb_get_property_reply (sn_display_get_x_connection (display),
+                                  cookie, NULL);
+  if (reply == NULL)
+    return NULL;
+
+  if (reply->type == sn_internal_get_utf8_string_atom (display) &&
+      reply->format == 8 &&
+      reply->bytes_after == 0)
+    {
+      const char *value = xcb_get_property_value (reply);
+      int len = xcb_get_property_value_length (reply);
+
+      if (len > 0 && sn_internal_utf8_validate (value, len))
+        str = sn_internal_strndup (value, len);
+    }
+
+  free (reply);
+
+  return str;
+}
+
+static xcb_window_t
+get_window_reply (SnDisplay                 *display,
+                  xcb_get_property_cookie_t  cookie)
+{
+  xcb_get_property_reply_t *reply;
+  xcb_window_t xwindow;
+
+  xwindow = XCB_WINDOW_NONE;
+
+  reply = xcb_get_property_reply (sn_display_get_x_connection (display),
+                                  cookie, NULL);
+  if (reply == NULL)
+    return XCB_WINDOW_NONE;
+
+  if (reply->type == XCB_ATOM_WINDOW &&
+      reply->format == 32 &&
+      xcb_get_property_value_length (reply) == sizeof (xcb_window_t))
+    xwindow = *(xcb_window_t*) xcb_get_property_value (reply);
+
+  free (reply);
+
+  return xwindow;
+}
+
+/**
+ * sn_internal_get_startup_ids:
+ * @display: an #SnDisplay
+ * @xwindows: windows to look up
+ * @n_windows: number of windows
+ * @startup_ids: array of @n_windows to return the startup IDs in
+ *
+ * Reads the _NET_STARTUP_ID of each window, or of its WM_CLIENT_LEADER
+ * if the window has none of its own. The requests for all windows are
+ * sent before any reply is read, and the atoms were requested when
+ * @display was created, so this takes two round trips however many
+ * windows there are. Windows without a startup ID get %NULL; the
+ * others a newly allocated string.
+ **/
+void
+sn_internal_get_startup_ids (SnDisplay          *display,
+                             const xcb_window_t *xwindows,
+                             int                 n_windows,
+                             char              **startup_ids)
+{
+  xcb_connection_t *c = sn_display_get_x_connection (display);
+  xcb_get_property_cookie_t *id_cookies;
+  xcb_get_property_cookie_t *leader_cookies;
+  xcb_window_t *leaders;
+  xcb_atom_t NET_STARTUP_ID;
+  xcb_atom_t WM_CLIENT_LEADER;
+  int n_leaders;
+  int i;
+
+  if (n_windows <= 0)
+    return;
+
+  NET_STARTUP_ID = sn_internal_get_net_startup_id_atom (display);
+  WM_CLIENT_LEADER = sn_internal_get_wm_client_leader_atom (display);
+
+  id_cookies = sn_new (xcb_get_property_cookie_t, n_windows);
+  leader_cookies = sn_new (xcb_get_property_cookie_t, n_windows);
+  leaders = sn_new (xcb_window_t, n_windows);
+
+  for (i = 0; i < n_windows; ++i)
+    {
+      id_cookies[i] = xcb_get_property (c, FALSE, xwindows[i], NET_STARTUP_ID,
+                                        XCB_GET_PROPERTY_TYPE_ANY,
+                                        0, MAX_PROPERTY_LENGTH);
+      leader_cookies[i] = xcb_get_property (c, FALSE, xwindows[i],
+                                            WM_CLIENT_LEADER,
+                                            XCB_ATOM_WINDOW, 0, 1);
+    }
+
+  n_leaders = 0;
+  for (i = 0; i < n_windows; ++i)
+    {
+      startup_ids[i] = get_utf8_string_reply (display, id_cookies[i]);
+
+      if (startup_ids[i] != NULL)
+        {
+          xcb_discard_reply (c, leader_cookies[i].sequence);
+          leaders[i] = XCB_WINDOW_NONE;
+        }
+      else
+        {
+          leaders[i] = get_window_reply (display, leader_cookies[i]);
+          if (leaders[i] == xwindows[i])
+            leaders[i] = XCB_WINDOW_NONE;
+        }
+
+      if (leaders[i] != XCB_WINDOW_NONE)
+        {
+          id_cookies[i] = xcb_get_property (c, FALSE, leaders[i],
+                                            NET_STARTUP_ID,
+                                            XCB_GET_PROPERTY_TYPE_ANY,
+                                            0, MAX_PROPERTY_LENGTH);
+          ++n_leaders;
+        }
+    }
+
+  for (i = 0; i < n_windows && n_leaders > 0; ++i)
+    {
+      if (leaders[i] != XCB_WINDOW_NONE)
+        {
+          startup_ids[i] = get_utf8_string_reply (display, id_cookies[i]);
+          --n_leaders;
+        }
+    }
+
+  sn_free (leaders);
+  sn_free (leader_cookies);
+  sn_free (id_cookies);
+}
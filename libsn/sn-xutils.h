@@ -33,6 +33,10 @@ void sn_internal_set_utf8_string (SnDisplay  *display,
                                   xcb_window_t xwindow,
                                   xcb_atom_t   property,
                                   const char *str);
+void sn_internal_get_startup_ids (SnDisplay          *display,
+                                  const xcb_window_t *xwindows,
+                                  int                 n_windows,
+                                  char              **startup_ids);
 
 
 SN_END_DECLS
@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2002 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <config.h>
+#include <libsn/sn.h>
+#include <libsn/sn-internals.h>
+
+#include "test-boilerplate.h"
+#include "test-bench.h"
+
+/* Microbenchmarks for the monitor. Run with the name of a
+ * benchmark as the only argument, or with no argument to run
+ * all of them.
+ */
+
+static void
+null_event_func (SnMonitorEvent *event,
+                 void           *user_data)
+{
+}
+
+/* Cost of a "change:" message that finds its sequence by ID,
+ * with 10, 1000 and 100000 live sequences.
+ */
+static void
+bench_lookup (xcb_connection_t *xconnection,
+              int               screen)
+{
+#define N_LOOKUPS 100000
+  static const int n_sequences[] = { 10, 1000, 100000 };
+  unsigned int i;
+
+  for (i = 0; i < sizeof (n_sequences) / sizeof (n_sequences[0]); ++i)
+    {
+      SnDisplay *display;
+      SnMonitorContext *context;
+      struct timeval start;
+      char message[128];
+      int j;
+
+      display = sn_xcb_display_new (xconnection, NULL, NULL);
+      context = sn_monitor_context_new (display, screen,
+                                        null_event_func, NULL, NULL);
+
+      for (j = 0; j < n_sequences[i]; ++j)
+        {
+          snprintf (message, sizeof (message),
+                    "new: ID=bench/app/%d-0-host_TIME%d SCREEN=%d",
+                    j, j, screen);
+          process_message (display, 0x1000 + j, message);
+        }
+
+      gettimeofday (&start, NULL);
+      for (j = 0; j < N_LOOKUPS; ++j)
+        {
+          int k = (j * 7919) % n_sequences[i];
+
+          snprintf (message, sizeof (message),
+                    "change: ID=bench/app/%d-0-host_TIME%d X-NOP=1",
+                    k, k);
+          process_message (display, 0x1000, message);
+        }
+
+      printf ("lookup: %6d sequences: %8.1f ns per message\n",
+              n_sequences[i], elapsed_nsec (&start) / N_LOOKUPS);
+
+      /* Sequences stay live until removed; drop them */
+      for (j = 0; j < n_sequences[i]; ++j)
+        {
+          snprintf (message, sizeof (message),
+                    "remove: ID=bench/app/%d-0-host_TIME%d", j, j);
+          process_message (display, 0x1000, message);
+        }
+
+      sn_monitor_context_unref (context);
+      sn_display_unref (display);
+    }
+}
+
+/* Cost of a "change:" message carrying every key the monitor
+ * understands plus a few unknown "X-" ones.
+ */
+static void
+bench_keys (xcb_connection_t *xconnection,
+            int               screen)
+{
+#define N_KEY_MESSAGES 100000
+  static const char *message =
+    "change: ID=bench/app/0-0-host_TIME0 BIN=gedit NAME=Text\\ Editor "
+    "DESCRIPTION=Launching ICON=accessories-text-editor WMCLASS=gedit "
+    "APPLICATION_ID=org.gnome.gedit.desktop TIMESTAMP=0 "
+    "X-FOO=1 X-BAR=2 X-KDE-LAUNCHER=1";
+  SnDisplay *display;
+  SnMonitorContext *context;
+  struct timeval start;
+  char new_message[128];
+  int i;
+
+  display = sn_xcb_display_new (xconnection, NULL, NULL);
+  context = sn_monitor_context_new (display, screen,
+                                    null_event_func, NULL, NULL);
+
+  snprintf (new_message, sizeof (new_message),
+            "new: ID=bench/app/0-0-host_TIME0 SCREEN=%d", screen);
+  process_message (display, 0x1000, new_message);
+
+  gettimeofday (&start, NULL);
+  for (i = 0; i < N_KEY_MESSAGES; ++i)
+    process_message (display, 0x1000, message);
+
+  printf ("keys: %8.1f ns per message\n",
+          elapsed_nsec (&start) / N_KEY_MESSAGES);
+
+  process_message (display, 0x1000, "remove: ID=bench/app/0-0-host_TIME0");
+
+  sn_monitor_context_unref (context);
+  sn_display_unref (display);
+}
+
+static const SnBenchmark benchmarks[] = {
+  { "lookup", bench_lookup },
+  { "keys", bench_keys }
+};
+
+int
+main (int argc, char **argv)
+{
+  return run_benchmarks (argc, argv, benchmarks,
+                         sizeof (benchmarks) / sizeof (benchmarks[0]));
+}
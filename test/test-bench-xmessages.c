@@ -0,0 +1,503 @@
+/*
+ * Copyright (C) 2002 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <config.h>
+#include <libsn/sn.h>
+#include <libsn/sn-xmessages.h>
+#include <libsn/sn-internals.h>
+
+#include <xcb/xcb_aux.h>
+#include <xcb/xcb_event.h>
+
+#include "test-boilerplate.h"
+#include "test-bench.h"
+
+/* Microbenchmarks for the X message layer. Run with the name
+ * of a benchmark as the only argument, or with no argument to
+ * run all of them.
+ */
+
+#define N_ITERATIONS 1000000
+
+static xcb_atom_t
+intern_atom (xcb_connection_t *xconnection,
+             const char       *name)
+{
+  xcb_intern_atom_reply_t *reply;
+  xcb_atom_t atom;
+
+  reply = xcb_intern_atom_reply (xconnection,
+                                 xcb_intern_atom (xconnection, FALSE,
+                                                  strlen (name), name),
+                                 NULL);
+  atom = reply ? reply->atom : XCB_ATOM_NONE;
+  free (reply);
+
+  return atom;
+}
+
+static void
+null_message_func (SnDisplay  *display,
+                   const char *message_type,
+                   const char *message,
+                   int         message_len,
+                   void       *user_data)
+{
+}
+
+/* Cost of rejecting a ClientMessage that no handler is
+ * interested in, e.g. WM_PROTOCOLS, with 1, 10 and 100
+ * handlers registered.
+ */
+static void
+bench_dispatch (xcb_connection_t *xconnection,
+                int               screen)
+{
+  static const int n_handlers[] = { 1, 10, 100 };
+  xcb_client_message_event_t xevent;
+  unsigned int i;
+
+  memset (&xevent, 0, sizeof (xevent));
+  xevent.response_type = XCB_CLIENT_MESSAGE;
+  xevent.format = 32;
+  xevent.type = intern_atom (xconnection, "WM_PROTOCOLS");
+
+  for (i = 0; i < sizeof (n_handlers) / sizeof (n_handlers[0]); ++i)
+    {
+      SnDisplay *display;
+      struct timeval start;
+      char type[64];
+      char type_begin[64];
+      int j;
+
+      display = sn_xcb_display_new (xconnection, NULL, NULL);
+      xevent.window = sn_internal_display_get_root_window (display, screen);
+
+      for (j = 0; j < n_handlers[i]; ++j)
+        {
+          snprintf (type, sizeof (type), "_SN_BENCH_%d", j);
+          snprintf (type_begin, sizeof (type_begin), "_SN_BENCH_%d_BEGIN", j);
+          sn_internal_add_xmessage_func (display, screen,
+                                         type, type_begin,
+                                         null_message_func,
+                                         NULL, NULL);
+        }
+
+      gettimeofday (&start, NULL);
+      for (j = 0; j < N_ITERATIONS; ++j)
+        sn_xcb_display_process_event (display,
+                                      (xcb_generic_event_t *) &xevent);
+
+      printf ("dispatch: %3d handlers: %6.1f ns per rejected event\n",
+              n_handlers[i], elapsed_nsec (&start) / N_ITERATIONS);
+
+      for (j = 0; j < n_handlers[i]; ++j)
+        {
+          snprintf (type, sizeof (type), "_SN_BENCH_%d", j);
+          sn_internal_remove_xmessage_func (display, screen, type,
+                                            null_message_func, NULL);
+        }
+
+      sn_display_unref (display);
+    }
+}
+
+/* Throughput of reassembling a 2 KB "new:" message from
+ * 20-byte ClientMessage chunks.
+ */
+static void
+bench_reassembly (xcb_connection_t *xconnection,
+                  int               screen)
+{
+#define MESSAGE_LENGTH 2048
+#define N_MESSAGES 20000
+  SnDisplay *display;
+  xcb_client_message_event_t xevent;
+  char message[MESSAGE_LENGTH];
+  struct timeval start;
+  double nsec;
+  int n_chunks;
+  int i;
+
+  display = sn_xcb_display_new (xconnection, NULL, NULL);
+  sn_internal_add_xmessage_func (display, screen,
+                                 "_NET_STARTUP_INFO",
+                                 "_NET_STARTUP_INFO_BEGIN",
+                                 null_message_func,
+                                 NULL, NULL);
+
+  memcpy (message, "new: ID=bench NAME=", 19);
+  memset (message + 19, 'x', MESSAGE_LENGTH - 19);
+  message[MESSAGE_LENGTH - 1] = '\0';
+
+  memset (&xevent, 0, sizeof (xevent));
+  xevent.response_type = XCB_CLIENT_MESSAGE;
+  xevent.format = 8;
+
+  n_chunks = 0;
+  gettimeofday (&start, NULL);
+  for (i = 0; i < N_MESSAGES; ++i)
+    {
+      int offset;
+
+      xevent.window = 0x1000 + i;
+      xevent.type = sn_internal_get_net_startup_info_begin_atom (display);
+
+      for (offset = 0; offset < MESSAGE_LENGTH; offset += 20)
+        {
+          int len = MESSAGE_LENGTH - offset < 20 ? MESSAGE_LENGTH - offset : 20;
+
+          memset (xevent.data.data8, 0, 20);
+          memcpy (xevent.data.data8, message + offset, len);
+          sn_xcb_display_process_event (display,
+                                        (xcb_generic_event_t *) &xevent);
+          xevent.type = sn_internal_get_net_startup_info_atom (display);
+          ++n_chunks;
+        }
+    }
+  nsec = elapsed_nsec (&start);
+
+  printf ("reassembly: %d-byte messages: %.0f chunks/sec\n",
+          MESSAGE_LENGTH, n_chunks / (nsec / 1e9));
+
+  sn_internal_remove_xmessage_func (display, screen, "_NET_STARTUP_INFO",
+                                    null_message_func, NULL);
+  sn_display_unref (display);
+}
+
+/* Parsing a short "remove:", a typical "new:" and a 4 KB
+ * message made of many escaped key-value pairs.
+ */
+static void
+bench_parse (xcb_connection_t *xconnection,
+             int               screen)
+{
+  static const char *typical =
+    "new: ID=gnome-panel/gedit/1234-0-myhost_TIME12345678 SCREEN=0 "
+    "NAME=Text\\ Editor DESCRIPTION=\"Launching Text Editor\" DESKTOP=2 "
+    "WMCLASS=gedit BIN=gedit ICON=accessories-text-editor "
+    "APPLICATION_ID=org.gnome.gedit.desktop";
+  char large[4096];
+  const char *messages[3];
+  const char *names[3] = { "short", "typical", "4 KB" };
+  int i;
+
+  large[0] = '\0';
+  strcat (large, "change: ID=foo");
+  while (strlen (large) < sizeof (large) - 40)
+    strcat (large, " X-KEY=\"value\\ with\\\"escapes\\\"\"");
+
+  messages[0] = "remove: ID=foo_TIME1234";
+  messages[1] = typical;
+  messages[2] = large;
+
+  for (i = 0; i < 3; ++i)
+    {
+      SnParsedMessage parsed;
+      struct timeval start;
+      int len;
+      int n_iterations;
+      int j;
+
+      len = strlen (messages[i]);
+      n_iterations = N_ITERATIONS / (1 + len / 64);
+
+      gettimeofday (&start, NULL);
+      for (j = 0; j < n_iterations; ++j)
+        {
+          if (sn_internal_parse_message (messages[i], len, &parsed))
+            sn_internal_parsed_message_free (&parsed);
+        }
+
+      printf ("parse: %7s (%4d bytes): %8.1f ns per message\n",
+              names[i], len, elapsed_nsec (&start) / n_iterations);
+    }
+}
+
+/* Sending a typical "new:" message, serialized to a string
+ * first versus escaped directly into the ClientMessages.
+ */
+static void
+bench_broadcast (xcb_connection_t *xconnection,
+                 int               screen)
+{
+#define N_BROADCASTS 100000
+  static const char *names[] = {
+    "ID", "SCREEN", "NAME", "DESCRIPTION", "DESKTOP",
+    "WMCLASS", "BIN", "ICON", "APPLICATION_ID", NULL
+  };
+  static const char *values[] = {
+    "gnome-panel/gedit/1234-0-myhost_TIME12345678", "0", "Text Editor",
+    "Launching Text Editor", "2", "gedit", "gedit",
+    "accessories-text-editor", "org.gnome.gedit.desktop", NULL
+  };
+  SnDisplay *display;
+  xcb_atom_t type;
+  xcb_atom_t type_begin;
+  struct timeval start;
+  int i;
+
+  display = sn_xcb_display_new (xconnection, NULL, NULL);
+  type = sn_internal_get_net_startup_info_atom (display);
+  type_begin = sn_internal_get_net_startup_info_begin_atom (display);
+
+  gettimeofday (&start, NULL);
+  for (i = 0; i < N_BROADCASTS; ++i)
+    {
+      char *message;
+
+      message = sn_internal_serialize_message ("new", names, values);
+      sn_internal_broadcast_xmessage (display, screen, type, type_begin,
+                                      message);
+      sn_free (message);
+    }
+
+  printf ("broadcast: string: %8.1f ns per message\n",
+          elapsed_nsec (&start) / N_BROADCASTS);
+
+  gettimeofday (&start, NULL);
+  for (i = 0; i < N_BROADCASTS; ++i)
+    sn_internal_broadcast_message (display, screen, type, type_begin,
+                                   "new", names, values);
+
+  printf ("broadcast: direct: %8.1f ns per message\n",
+          elapsed_nsec (&start) / N_BROADCASTS);
+
+  sn_display_unref (display);
+}
+
+static void
+sync_connection (xcb_connection_t *xconnection)
+{
+  free (xcb_get_input_focus_reply (xconnection,
+                                   xcb_get_input_focus (xconnection),
+                                   NULL));
+}
+
+/* X requests made and events delivered to a client watching the
+ * root window, per message sent, with and without reusing the
+ * identifier windows.
+ */
+static void
+bench_window_pool (xcb_connection_t *xconnection,
+                   int               screen)
+{
+#define N_POOL_MESSAGES 1000
+  static const char *names[] = { "ID", NULL };
+  static const char *values[] = { "gnome-panel/gedit/1234-0-myhost_TIME12345678", NULL };
+  xcb_connection_t *listener;
+  xcb_window_t root;
+  uint32_t mask;
+  int reuse;
+
+  listener = xcb_connect (NULL, NULL);
+  root = xcb_aux_get_screen (listener, screen)->root;
+  mask = XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY | XCB_EVENT_MASK_PROPERTY_CHANGE;
+  xcb_change_window_attributes (listener, root, XCB_CW_EVENT_MASK, &mask);
+  sync_connection (listener);
+
+  for (reuse = FALSE; reuse <= TRUE; ++reuse)
+    {
+      SnDisplay *display;
+      xcb_generic_event_t *event;
+      unsigned int first_request;
+      int n_requests;
+      int n_events;
+      int n_structure_events;
+      int i;
+
+      display = sn_xcb_display_new (xconnection, NULL, NULL);
+      sn_display_set_reuse_message_windows (display, reuse);
+
+      first_request = xcb_no_operation (xconnection).sequence;
+      for (i = 0; i < N_POOL_MESSAGES; ++i)
+        sn_internal_broadcast_message (display, screen,
+                                       sn_internal_get_net_startup_info_atom (display),
+                                       sn_internal_get_net_startup_info_begin_atom (display),
+                                       "remove", names, values);
+      n_requests = xcb_no_operation (xconnection).sequence - first_request - 1;
+
+      sn_display_unref (display);
+      sync_connection (xconnection);
+      sync_connection (listener);
+
+      n_events = 0;
+      n_structure_events = 0;
+      while ((event = xcb_poll_for_event (listener)) != NULL)
+        {
+          switch (XCB_EVENT_RESPONSE_TYPE (event))
+            {
+            case XCB_CREATE_NOTIFY:
+            case XCB_DESTROY_NOTIFY:
+              ++n_structure_events;
+              break;
+            }
+          ++n_events;
+          free (event);
+        }
+
+      printf ("window pool: %-5s: %5.2f requests, %5.2f events per message "
+              "(%d create/destroy notifies)\n",
+              reuse ? "on" : "off",
+              (double) n_requests / N_POOL_MESSAGES,
+              (double) n_events / N_POOL_MESSAGES,
+              n_structure_events);
+    }
+
+  xcb_disconnect (listener);
+}
+
+/* Time to send 40 "new:" messages, as a session restore might,
+ * one at a time versus in a batch.
+ */
+static void
+bench_batch (xcb_connection_t *xconnection,
+             int               screen)
+{
+#define N_BATCH_MESSAGES 40
+#define N_BATCHES 1000
+  static const char *names[] = { "ID", "NAME", "SCREEN", NULL };
+  static const char *values[] = { "gnome-session/gedit/1234-0-myhost_TIME0", "Text Editor", "0", NULL };
+  SnDisplay *display;
+  int batched;
+
+  display = sn_xcb_display_new (xconnection, NULL, NULL);
+
+  for (batched = FALSE; batched <= TRUE; ++batched)
+    {
+      struct timeval start;
+      int i;
+      int j;
+
+      gettimeofday (&start, NULL);
+      for (i = 0; i < N_BATCHES; ++i)
+        {
+          if (batched)
+            sn_display_begin_batch (display);
+
+          for (j = 0; j < N_BATCH_MESSAGES; ++j)
+            sn_internal_broadcast_message (display, screen,
+                                           sn_internal_get_net_startup_info_atom (display),
+                                           sn_internal_get_net_startup_info_begin_atom (display),
+                                           "new", names, values);
+
+          if (batched)
+            sn_display_end_batch (display);
+
+          sync_connection (xconnection);
+        }
+
+      printf ("batch: %-9s: %8.1f us per %d messages\n",
+              batched ? "batched" : "unbatched",
+              elapsed_nsec (&start) / N_BATCHES / 1e3,
+              N_BATCH_MESSAGES);
+    }
+
+  sn_display_unref (display);
+}
+
+static void
+bench_ingest (xcb_connection_t *xconnection,
+              int               screen)
+{
+#define BATCH_SIZE 64
+#define N_INGEST_BATCHES 100000
+  static const char message[] = "change: ID=bench DESKTOP=1";
+  SnDisplay *display;
+  xcb_client_message_event_t chunks[2];
+  xcb_motion_notify_event_t motion;
+  xcb_generic_event_t *events[BATCH_SIZE];
+  unsigned char handled_mask[BATCH_SIZE / 8];
+  struct timeval start;
+  double one_nsec;
+  double batch_nsec;
+  int i;
+  int j;
+
+  display = sn_xcb_display_new (xconnection, NULL, NULL);
+  sn_internal_add_xmessage_func (display, screen,
+                                 "_NET_STARTUP_INFO",
+                                 "_NET_STARTUP_INFO_BEGIN",
+                                 null_message_func,
+                                 NULL, NULL);
+
+  /* A two-chunk message amid input events, as a compositor sees */
+  memset (chunks, 0, sizeof (chunks));
+  for (i = 0; i < 2; ++i)
+    {
+      chunks[i].response_type = XCB_CLIENT_MESSAGE;
+      chunks[i].format = 8;
+      chunks[i].window = 0x1000;
+      memcpy (chunks[i].data.data8, message + i * 20,
+              i == 0 ? 20 : sizeof (message) - 20);
+    }
+  chunks[0].type = sn_internal_get_net_startup_info_begin_atom (display);
+  chunks[1].type = sn_internal_get_net_startup_info_atom (display);
+
+  memset (&motion, 0, sizeof (motion));
+  motion.response_type = XCB_MOTION_NOTIFY;
+
+  for (i = 0; i < BATCH_SIZE; ++i)
+    events[i] = (xcb_generic_event_t *) &motion;
+  events[BATCH_SIZE / 2] = (xcb_generic_event_t *) &chunks[0];
+  events[BATCH_SIZE / 2 + 1] = (xcb_generic_event_t *) &chunks[1];
+
+  gettimeofday (&start, NULL);
+  for (i = 0; i < N_INGEST_BATCHES; ++i)
+    for (j = 0; j < BATCH_SIZE; ++j)
+      sn_xcb_display_process_event (display, events[j]);
+  one_nsec = elapsed_nsec (&start);
+
+  gettimeofday (&start, NULL);
+  for (i = 0; i < N_INGEST_BATCHES; ++i)
+    sn_xcb_display_process_events (display, events, BATCH_SIZE,
+                                   handled_mask);
+  batch_nsec = elapsed_nsec (&start);
+
+  printf ("ingest: %d-event batches: %.1f ns per event one at a time, "
+          "%.1f ns batched\n", BATCH_SIZE,
+          one_nsec / ((double) N_INGEST_BATCHES * BATCH_SIZE),
+          batch_nsec / ((double) N_INGEST_BATCHES * BATCH_SIZE));
+
+  sn_internal_remove_xmessage_func (display, screen, "_NET_STARTUP_INFO",
+                                    null_message_func, NULL);
+  sn_display_unref (display);
+}
+
+static const SnBenchmark benchmarks[] = {
+  { "dispatch", bench_dispatch },
+  { "reassembly", bench_reassembly },
+  { "parse", bench_parse },
+  { "broadcast", bench_broadcast },
+  { "window-pool", bench_window_pool },
+  { "batch", bench_batch },
+  { "ingest", bench_ingest }
+};
+
+int
+main (int argc, char **argv)
+{
+  return run_benchmarks (argc, argv, benchmarks,
+                         sizeof (benchmarks) / sizeof (benchmarks[0]));
+}
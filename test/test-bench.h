@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2002 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Driver shared by the benchmark programs. Each one lists its
+ * benchmarks in a table and hands it to run_benchmarks() from main().
+ */
+
+#include <sys/time.h>
+
+typedef struct
+{
+  const char *name;
+  void (* func) (xcb_connection_t *xconnection,
+                 int               screen);
+} SnBenchmark;
+
+static double
+elapsed_nsec (const struct timeval *start)
+{
+  struct timeval now;
+
+  gettimeofday (&now, NULL);
+
+  return ((now.tv_sec - start->tv_sec) * 1e9 +
+          (now.tv_usec - start->tv_usec) * 1e3);
+}
+
+/* Runs the benchmark named on the command line, or all of them
+ * with no argument; returns the exit status for main()
+ */
+static int
+run_benchmarks (int                argc,
+                char             **argv,
+                const SnBenchmark *benchmarks,
+                int                n_benchmarks)
+{
+  xcb_connection_t *xconnection;
+  int screen;
+  int i;
+  sn_bool_t found;
+
+  if (argc > 2)
+    {
+      fprintf (stderr, "Usage: %s [benchmark]\n", argv[0]);
+      return 1;
+    }
+
+  xconnection = xcb_connect (NULL, &screen);
+  if (xconnection == NULL || xcb_connection_has_error (xconnection))
+    {
+      fprintf (stderr, "Could not open display\n");
+      return 1;
+    }
+
+  found = FALSE;
+  for (i = 0; i < n_benchmarks; ++i)
+    {
+      if (argc == 2 && strcmp (argv[1], benchmarks[i].name) != 0)
+        continue;
+
+      (* benchmarks[i].func) (xconnection, screen);
+      found = TRUE;
+    }
+
+  xcb_disconnect (xconnection);
+
+  if (!found)
+    {
+      fprintf (stderr, "No benchmark named \"%s\"\n", argv[1]);
+      return 1;
+    }
+
+  return 0;
+}
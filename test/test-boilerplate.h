@@ -120,3 +120,35 @@ error_trap_pop (SnDisplay *display,
   XSync (xdisplay, False); /* get all errors out of the queue */
   --error_trap_depth;
 }
+
+#ifdef __SN_INTERNALS_H__
+/* Feeds @message to @display as if it had arrived from the
+ * X server in ClientMessages
+ */
+static void
+process_message (SnDisplay    *display,
+                 xcb_window_t  xwindow,
+                 const char   *message)
+{
+  xcb_client_message_event_t xevent;
+  int len;
+  int offset;
+
+  memset (&xevent, 0, sizeof (xevent));
+  xevent.response_type = XCB_CLIENT_MESSAGE;
+  xevent.format = 8;
+  xevent.window = xwindow;
+  xevent.type = sn_internal_get_net_startup_info_begin_atom (display);
+
+  len = strlen (message) + 1;
+  for (offset = 0; offset < len; offset += 20)
+    {
+      memset (xevent.data.data8, 0, 20);
+      memcpy (xevent.data.data8, message + offset,
+              len - offset < 20 ? len - offset : 20);
+      sn_xcb_display_process_event (display,
+                                    (xcb_generic_event_t *) &xevent);
+      xevent.type = sn_internal_get_net_startup_info_atom (display);
+    }
+}
+#endif /* __SN_INTERNALS_H__ */
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2002 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <config.h>
+#include <libsn/sn.h>
+#include <libsn/sn-internals.h>
+
+#include "test-boilerplate.h"
+
+/* Checks that the number of allocations made while dispatching
+ * a message does not depend on the number of monitor contexts.
+ */
+
+static int n_allocations = 0;
+
+static void*
+counting_malloc (sn_size_t n_bytes)
+{
+  ++n_allocations;
+  return malloc (n_bytes);
+}
+
+static void*
+counting_realloc (void      *mem,
+                  sn_size_t  n_bytes)
+{
+  ++n_allocations;
+  return realloc (mem, n_bytes);
+}
+
+static void
+counting_free (void *mem)
+{
+  free (mem);
+}
+
+static int n_events = 0;
+
+static void
+monitor_event_func (SnMonitorEvent *event,
+                    void           *user_data)
+{
+  ++n_events;
+}
+
+/* Allocations made for one startup sequence going from "new:"
+ * through "change:" to "remove:"
+ */
+static int
+count_launch_allocations (SnDisplay *display,
+                          int        screen,
+                          int        serial)
+{
+  char message[128];
+  int before;
+
+  before = n_allocations;
+
+  snprintf (message, sizeof (message),
+            "new: ID=alloc-test-%d_TIME0 SCREEN=%d NAME=Test", serial, screen);
+  process_message (display, 0x1000, message);
+
+  snprintf (message, sizeof (message),
+            "change: ID=alloc-test-%d_TIME0 DESKTOP=1", serial);
+  process_message (display, 0x1000, message);
+
+  snprintf (message, sizeof (message),
+            "remove: ID=alloc-test-%d_TIME0", serial);
+  process_message (display, 0x1000, message);
+
+  return n_allocations - before;
+}
+
+int
+main (int argc, char **argv)
+{
+  static const int n_contexts[] = { 1, 100 };
+  SnMemVTable vtable;
+  xcb_connection_t *xconnection;
+  int screen;
+  int counts[2];
+  unsigned int i;
+
+  memset (&vtable, 0, sizeof (vtable));
+  vtable.malloc = counting_malloc;
+  vtable.realloc = counting_realloc;
+  vtable.free = counting_free;
+  sn_mem_set_vtable (&vtable);
+
+  xconnection = xcb_connect (NULL, &screen);
+  if (xconnection == NULL || xcb_connection_has_error (xconnection))
+    {
+      fprintf (stderr, "Could not open display\n");
+      return 1;
+    }
+
+  for (i = 0; i < sizeof (n_contexts) / sizeof (n_contexts[0]); ++i)
+    {
+      SnDisplay *display;
+      SnMonitorContext **contexts;
+      int j;
+
+      display = sn_xcb_display_new (xconnection, NULL, NULL);
+
+      contexts = malloc (sizeof (SnMonitorContext*) * n_contexts[i]);
+      for (j = 0; j < n_contexts[i]; ++j)
+        contexts[j] = sn_monitor_context_new (display, screen,
+                                              monitor_event_func,
+                                              NULL, NULL);
+
+      /* The first launch fills caches and free lists */
+      count_launch_allocations (display, screen, 0);
+
+      n_events = 0;
+      counts[i] = count_launch_allocations (display, screen, 1);
+
+      printf ("%3d contexts: %d events, %d allocations\n",
+              n_contexts[i], n_events, counts[i]);
+
+      if (n_events != 3 * n_contexts[i])
+        {
+          fprintf (stderr, "Expected %d events\n", 3 * n_contexts[i]);
+          return 1;
+        }
+
+      for (j = 0; j < n_contexts[i]; ++j)
+        sn_monitor_context_unref (contexts[j]);
+      free (contexts);
+
+      sn_display_unref (display);
+    }
+
+  if (counts[0] != counts[1])
+    {
+      fprintf (stderr, "Allocations depend on the number of contexts\n");
+      return 1;
+    }
+
+  xcb_disconnect (xconnection);
+
+  return 0;
+}
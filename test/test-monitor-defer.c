@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2002 Red Hat, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <config.h>
+#include <libsn/sn.h>
+#include <libsn/sn-internals.h>
+
+#include "test-boilerplate.h"
+
+/* Checks that deferring dispatch with sn_display_set_defer_dispatch()
+ * only delays the callbacks: the same messages must produce the same
+ * events, and sequences must end as soon as their "remove:" arrives.
+ */
+
+static char event_log[256];
+
+static void
+monitor_event_func (SnMonitorEvent *event,
+                    void           *user_data)
+{
+  static const char *names[] = { "initiated", "completed",
+                                 "changed", "canceled" };
+
+  strcat (event_log, names[sn_monitor_event_get_type (event)]);
+  strcat (event_log, " ");
+}
+
+static sn_bool_t
+count_sequence_func (SnStartupSequence *sequence,
+                     void              *data)
+{
+  ++*(int *) data;
+  return TRUE;
+}
+
+static int
+count_sequences (SnMonitorContext *context)
+{
+  int n_sequences;
+
+  n_sequences = 0;
+  sn_monitor_context_foreach_sequence (context, count_sequence_func,
+                                       &n_sequences);
+
+  return n_sequences;
+}
+
+static int
+check (sn_bool_t   condition,
+       const char *what)
+{
+  if (!condition)
+    fprintf (stderr, "Failed: %s\n", what);
+
+  return condition ? 0 : 1;
+}
+
+/* Starts, ends and restarts a sequence with the same ID; returns
+ * the number of failed checks
+ */
+static int
+run_launch (SnDisplay *display,
+            int        screen,
+            sn_bool_t  defer)
+{
+  SnMonitorContext *context;
+  char message[128];
+  int n_failed;
+
+  n_failed = 0;
+  event_log[0] = '\0';
+
+  context = sn_monitor_context_new (display, screen,
+                                    monitor_event_func,
+                                    NULL, NULL);
+  sn_display_set_defer_dispatch (display, defer);
+
+  snprintf (message, sizeof (message),
+            "new: ID=defer-test SCREEN=%d WMCLASS=DeferTest", screen);
+  process_message (display, 0x1000, message);
+  process_message (display, 0x1000, "remove: ID=defer-test");
+
+  /* Ended, even if no one has been told yet */
+  n_failed += check (sn_monitor_find_sequence_by_wmclass (display,
+                                                          NULL,
+                                                          "DeferTest") == NULL,
+                     "removed sequence found by WMCLASS");
+  n_failed += check (count_sequences (context) == 0,
+                     "removed sequence still iterated");
+
+  process_message (display, 0x1000, message);
+
+  if (defer)
+    n_failed += check (event_log[0] == '\0',
+                       "events dispatched while deferred");
+
+  sn_display_dispatch_pending (display);
+
+  n_failed += check (strcmp (event_log,
+                             "initiated completed initiated ") == 0,
+                     "events for a restarted ID");
+  n_failed += check (sn_monitor_find_sequence_by_wmclass (display,
+                                                          NULL,
+                                                          "DeferTest") != NULL,
+                     "restarted sequence not found by WMCLASS");
+  n_failed += check (count_sequences (context) == 1,
+                     "restarted sequence not iterated");
+  n_failed += check (!sn_display_has_pending (display),
+                     "events left after dispatching");
+
+  process_message (display, 0x1000, "remove: ID=defer-test");
+  sn_display_dispatch_pending (display);
+
+  sn_display_set_defer_dispatch (display, FALSE);
+  sn_monitor_context_unref (context);
+
+  return n_failed;
+}
+
+int
+main (int argc, char **argv)
+{
+  xcb_connection_t *xconnection;
+  SnDisplay *display;
+  int screen;
+  int n_failed;
+
+  xconnection = xcb_connect (NULL, &screen);
+  if (xconnection == NULL || xcb_connection_has_error (xconnection))
+    {
+      fprintf (stderr, "Could not open display\n");
+      return 1;
+    }
+
+  display = sn_xcb_display_new (xconnection, NULL, NULL);
+
+  n_failed = 0;
+  n_failed += run_launch (display, screen, FALSE);
+  n_failed += run_launch (display, screen, TRUE);
+
+  sn_display_unref (display);
+  xcb_disconnect (xconnection);
+
+  return n_failed == 0 ? 0 : 1;
+}
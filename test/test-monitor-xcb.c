@@ -28,6 +28,8 @@
 
 #include <xcb/xcb_aux.h>
 
+#include <poll.h>
+
 #include "test-boilerplate.h"
 
 static void
@@ -124,11 +126,24 @@ main (int argc, char **argv)
 
   while (TRUE)
     {
-      xcb_generic_event_t *xevent = xcb_wait_for_event (xconnection);
+      xcb_generic_event_t *xevent;
+      struct pollfd pfd;
+
+      xcb_flush (xconnection);
+
+      /* Wake up in time to cancel sequences that never complete */
+      pfd.fd = xcb_get_file_descriptor (xconnection);
+      pfd.events = POLLIN;
+      poll (&pfd, 1, sn_display_get_next_timeout (display));
+
+      while ((xevent = xcb_poll_for_event (xconnection)) != NULL)
+        {
+          sn_xcb_display_process_event (display, xevent);
 
-      sn_xcb_display_process_event (display, xevent);
+          free (xevent);
+        }
 
-      free (xevent);
+      sn_display_dispatch_timeouts (display);
     }
 
   sn_monitor_context_unref (context);
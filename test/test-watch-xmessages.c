@@ -33,6 +33,7 @@ static void
 message_func (SnDisplay       *display,
               const char      *message_type,
               const char      *message,
+              int              message_len,
               void            *user_data)
 {
   char *prefix;